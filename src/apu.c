@@ -0,0 +1,346 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "apu_tables.h"
+
+// APU_RATE / 4194304 in samples << 32 per clock, exact since the clock is a power of 2
+#define SAMPLE_STEP ((uint64_t)APU_RATE << 10)
+#define GAIN 48 // every channel at full level and volume on one side stays inside int16
+
+enum { NR10, NR11, NR12, NR13, NR14, NR21 = 0x06, NR22, NR23, NR24, NR30, NR31, NR32, NR33, NR34,
+    NR41 = 0x10, NR42, NR43, NR44, NR50, NR51, NR52 };
+
+// bits that read back as 1, the write only and unused ones
+static const uint8_t apu_read_mask[0x20] = {
+    0x80, 0x3f, 0x00, 0xff, 0xbf, 0xff, 0x3f, 0x00, 0xff, 0xbf, 0x7f, 0xff, 0x9f, 0xff, 0xbf, 0xff,
+    0xff, 0x00, 0x00, 0xbf, 0x00, 0x00, 0x70, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// the square duty cycles, bit n is step n
+static const uint8_t apu_duty[4] = {0x80, 0x81, 0xe1, 0x7e};
+
+// each channel has 5 registers from ff10, NRx0 to NRx4
+static inline const uint8_t *apu_regs(const apu *self, int c) {
+    return &self->regs[c * 5];
+}
+
+static inline bool apu_powered(const apu *self) {
+    return self->regs[NR52] & 0x80;
+}
+
+static inline bool apu_dac(const apu *self, int c) {
+    const uint8_t *r = apu_regs(self, c);
+    return c == 2 ? r[0] & 0x80 : r[2] & 0xf8;
+}
+
+// clocks between steps of the waveform
+static uint32_t apu_period(const apu *self, int c) {
+    const uint8_t *r = apu_regs(self, c);
+    if (c == 3) {
+        uint32_t div = r[3] & 7 ? (r[3] & 7) * 16 : 8;
+        return div << (r[3] >> 4);
+    }
+    return (2048 - (r[3] | (r[4] & 7) << 8)) * (c == 2 ? 2 : 4);
+}
+
+// what a channel puts out in its current state
+static uint8_t apu_level(const apu *self, int c) {
+    const apu_channel *ch = &self->ch[c];
+    if (!ch->on)
+        return 0;
+    switch (c) {
+        case 2: {
+            uint8_t code = (self->regs[NR32] >> 5) & 3, sample = (self->wave[ch->pos >> 1] >> (ch->pos & 1 ? 0 : 4)) & 0xf;
+            return code ? sample >> (code - 1) : 0;
+        }
+        case 3:
+            return self->lfsr & 1 ? 0 : ch->vol;
+        default:
+            return (apu_duty[apu_regs(self, c)[1] >> 6] >> ch->pos) & 1 ? ch->vol : 0;
+    }
+}
+
+// how much a level of 1 from each channel moves the left and right outputs
+static void apu_gains(const apu *self, int32_t gain[4][2]) {
+    uint8_t nr50 = self->regs[NR50], nr51 = self->regs[NR51];
+    for (int c = 0; c < 4; ++c) {
+        gain[c][0] = (nr51 >> (c + 4)) & 1 ? (((nr50 >> 4) & 7) + 1) * GAIN : 0;
+        gain[c][1] = (nr51 >> c) & 1 ? ((nr50 & 7) + 1) * GAIN : 0;
+    }
+}
+
+// adds a band-limited step to each side at 'pos', in samples << 32
+static void apu_step(apu_out *out, uint64_t pos, int32_t left, int32_t right) {
+    const int16_t *k = apu_kernel[(pos >> 27) & (APU_PHASES - 1)];
+    int32_t *l = &out->buf[0][pos >> 32], *r = &out->buf[1][pos >> 32];
+    for (int i = 0; i < APU_TAPS; ++i) {
+        l[i] += left * k[i];
+        r[i] += right * k[i];
+    }
+    out->level[0] += left;
+    out->level[1] += right;
+}
+
+// brings the output up to date at 'time' after something other than a waveform step
+static void apu_refresh(apu *self) {
+    apu_out *out = self->out;
+    int32_t gain[4][2], level[2] = {0, 0};
+    apu_gains(self, gain);
+    for (int c = 0; c < 4; ++c) {
+        self->ch[c].out = apu_level(self, c);
+        level[0] += self->ch[c].out * gain[c][0];
+        level[1] += self->ch[c].out * gain[c][1];
+    }
+    if (level[0] != out->level[0] || level[1] != out->level[1])
+        apu_step(out, out->frac, level[0] - out->level[0], level[1] - out->level[1]);
+}
+
+// integrates up to 'max' finished samples into 'dst' (or drops them if NULL) and shifts the rest down
+static size_t apu_take(apu_out *out, int16_t *dst, size_t max) {
+    size_t ready = out->frac >> 32, n = ready < max ? ready : max;
+    for (int s = 0; s < 2; ++s) {
+        int32_t sum = out->sum[s], dc = out->dc[s];
+        for (size_t i = 0; i < n; ++i) {
+            sum += out->buf[s][i];
+            int32_t v = (sum >> 15) - (dc >> 10);
+            dc += v;
+            if (dst)
+                dst[i * 2 + s] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+        }
+        out->sum[s] = sum;
+        out->dc[s] = dc;
+        memmove(out->buf[s], out->buf[s] + n, (ready - n + APU_TAPS) * sizeof(int32_t));
+        memset(out->buf[s] + ready - n + APU_TAPS, 0, n * sizeof(int32_t));
+    }
+    out->frac -= (uint64_t)n << 32;
+    return n;
+}
+
+// steps a channel's waveform through 'clocks' clocks from 'time'
+static void apu_run_channel(apu *self, int c, uint32_t clocks, const int32_t gain[2]) {
+    apu_channel *ch = &self->ch[c];
+    if (!ch->on)
+        return;
+    uint32_t period = apu_period(self, c), t = ch->timer;
+    for (; t < clocks; t += period) {
+        if (c == 3) {
+            uint16_t bit = (self->lfsr ^ (self->lfsr >> 1)) & 1;
+            self->lfsr = (self->lfsr >> 1) | bit << 14;
+            if (self->regs[NR43] & 0x08) // 7 bit mode
+                self->lfsr = (self->lfsr & ~0x40) | bit << 6;
+        } else {
+            ch->pos = (ch->pos + 1) & (c == 2 ? 31 : 7);
+        }
+        uint8_t level = apu_level(self, c);
+        if (level != ch->out) {
+            int32_t d = level - ch->out;
+            ch->out = level;
+            apu_step(self->out, self->out->frac + t * SAMPLE_STEP, d * gain[0], d * gain[1]);
+        }
+    }
+    ch->timer = t - clocks;
+}
+
+// synthesizes every channel from 'time' to 'until', which never crosses a frame sequencer step
+static void apu_synth(apu *self, uint64_t until) {
+    apu_out *out = self->out;
+    uint32_t clocks = (until - self->time) * 4;
+    // nobody is taking the samples, so the oldest make room
+    if (((out->frac + clocks * SAMPLE_STEP) >> 32) + APU_TAPS + 1 > APU_BUF + APU_TAPS)
+        apu_take(out, NULL, SIZE_MAX);
+    int32_t gain[4][2];
+    apu_gains(self, gain);
+    for (int c = 0; c < 4; ++c)
+        apu_run_channel(self, c, clocks, gain[c]);
+    out->frac += clocks * SAMPLE_STEP;
+}
+
+// the new frequency for square 1's sweep, which stops the channel if it overflows
+static uint16_t apu_sweep_calc(apu *self) {
+    uint8_t nr10 = self->regs[NR10];
+    uint16_t delta = self->shadow >> (nr10 & 7), freq = nr10 & 0x08 ? self->shadow - delta : self->shadow + delta;
+    if (freq > 2047)
+        self->ch[0].on = false;
+    return freq;
+}
+
+static void apu_sweep(apu *self) {
+    uint8_t nr10 = self->regs[NR10], period = (nr10 >> 4) & 7;
+    if (self->sweep_timer && --self->sweep_timer)
+        return;
+    self->sweep_timer = period ? period : 8;
+    if (!self->sweep_on || !period)
+        return;
+    uint16_t freq = apu_sweep_calc(self);
+    if (freq <= 2047 && (nr10 & 7)) {
+        self->shadow = freq;
+        self->regs[NR13] = freq & 0xff;
+        self->regs[NR14] = (self->regs[NR14] & ~7) | freq >> 8;
+        apu_sweep_calc(self); // checked again with the new frequency
+    }
+}
+
+// lengths on even steps, sweep on 2 and 6, envelopes on 7
+static void apu_frame_step(apu *self) {
+    uint8_t step = self->fs_step;
+    self->fs_step = (step + 1) & 7;
+    for (int c = 0; c < 4; ++c) {
+        apu_channel *ch = &self->ch[c];
+        const uint8_t *r = apu_regs(self, c);
+        if (!(step & 1) && (r[4] & 0x40) && ch->len && !--ch->len)
+            ch->on = false;
+        if (step == 7 && c != 2 && (r[2] & 7)) {
+            if (ch->env_timer > 1) {
+                --ch->env_timer;
+                continue;
+            }
+            ch->env_timer = r[2] & 7;
+            if ((r[2] & 0x08) && ch->vol < 15)
+                ++ch->vol;
+            else if (!(r[2] & 0x08) && ch->vol > 0)
+                --ch->vol;
+        }
+    }
+    if (step == 2 || step == 6)
+        apu_sweep(self);
+    if (self->out)
+        apu_refresh(self);
+}
+
+static void apu_sync(apu *self, uint64_t now) {
+    bool playing = self->ch[0].on || self->ch[1].on || self->ch[2].on || self->ch[3].on;
+    if (!self->out && !playing) {
+        // nothing to synthesize and nothing the frame sequencer would change, skip straight there
+        if (now >= self->fs_time) {
+            uint64_t steps = (now - self->fs_time) / APU_FS_CYCLES + 1;
+            self->fs_step = (self->fs_step + steps) & 7;
+            self->fs_time += steps * APU_FS_CYCLES;
+        }
+        self->time = now;
+        return;
+    }
+    while (self->time < now) {
+        uint64_t until = now < self->fs_time ? now : self->fs_time;
+        if (self->out)
+            apu_synth(self, until);
+        self->time = until;
+        if (until == self->fs_time) {
+            apu_frame_step(self);
+            self->fs_time += APU_FS_CYCLES;
+        }
+    }
+}
+
+static void apu_trigger(apu *self, int c) {
+    apu_channel *ch = &self->ch[c];
+    const uint8_t *r = apu_regs(self, c);
+    ch->on = apu_dac(self, c);
+    if (!ch->len)
+        ch->len = c == 2 ? 256 : 64;
+    ch->timer = apu_period(self, c);
+    ch->vol = r[2] >> 4;
+    ch->env_timer = r[2] & 7 ? r[2] & 7 : 8;
+    if (c == 0) {
+        uint8_t period = (r[0] >> 4) & 7;
+        self->shadow = r[3] | (r[4] & 7) << 8;
+        self->sweep_timer = period ? period : 8;
+        self->sweep_on = period || (r[0] & 7);
+        if (r[0] & 7)
+            apu_sweep_calc(self);
+    } else if (c == 2) {
+        ch->pos = 0;
+    } else if (c == 3) {
+        self->lfsr = 0x7fff;
+    }
+}
+
+void apu_init(apu *self, sched *sched) {
+    memset(self, 0, sizeof(*self));
+    self->time = sched->now;
+    self->fs_time = sched->now + APU_FS_CYCLES;
+    self->lfsr = 0x7fff;
+}
+
+void apu_deinit(apu *self) {
+    free(self->out);
+    self->out = NULL;
+}
+
+bool apu_use_output(apu *self, sched *sched, bool on) {
+    apu_sync(self, sched->now);
+    if (!on) {
+        apu_deinit(self);
+        return true;
+    }
+    if (self->out)
+        return true;
+    if (!(self->out = calloc(1, sizeof(apu_out))))
+        return false;
+    for (int c = 0; c < 4; ++c)
+        self->ch[c].out = 0;
+    apu_refresh(self);
+    return true;
+}
+
+uint8_t apu_read(apu *self, sched *sched, uint16_t addr) {
+    if (addr >= 0xff30) // wave ram
+        return self->wave[addr - 0xff30];
+    uint8_t reg = addr - 0xff10;
+    if (reg == NR52) { // the channel bits are the only thing that changes on its own
+        apu_sync(self, sched->now);
+        uint8_t on = 0;
+        for (int c = 0; c < 4; ++c)
+            on |= self->ch[c].on << c;
+        return self->regs[NR52] | apu_read_mask[NR52] | on;
+    }
+    return self->regs[reg] | apu_read_mask[reg];
+}
+
+void apu_write(apu *self, sched *sched, uint16_t addr, uint8_t val) {
+    apu_sync(self, sched->now);
+    uint8_t reg = addr - 0xff10;
+    if (addr >= 0xff30) {
+        self->wave[addr - 0xff30] = val;
+    } else if (reg == NR52) {
+        if (!(val & 0x80) && apu_powered(self)) { // everything but wave ram is cleared
+            memset(self->regs, 0, NR52);
+            for (int c = 0; c < 4; ++c)
+                self->ch[c].on = false;
+        } else if ((val & 0x80) && !apu_powered(self)) {
+            self->fs_step = 0;
+        }
+        self->regs[NR52] = val & 0x80;
+    } else if (apu_powered(self) && reg < NR50) { // registers ignore writes while it's off
+        int c = reg / 5;
+        apu_channel *ch = &self->ch[c];
+        self->regs[reg] = val;
+        switch (reg % 5) {
+            case 0: // wave dac
+            case 2: // volume and envelope, the upper 5 bits clear turns the dac off
+                if (!apu_dac(self, c))
+                    ch->on = false;
+                break;
+            case 1: // length
+                ch->len = c == 2 ? 256 - val : 64 - (val & 63);
+                break;
+            case 4:
+                if (val & 0x80)
+                    apu_trigger(self, c);
+                break;
+        }
+    } else if (apu_powered(self) && reg < NR52) {
+        self->regs[reg] = val;
+    }
+    if (self->out)
+        apu_refresh(self);
+}
+
+size_t apu_samples(apu *self, uint64_t now, int16_t *out, size_t max) {
+    if (!self->out)
+        return 0;
+    apu_sync(self, now);
+    return apu_take(self->out, out, max);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sched.h"
+
+#define APU_RATE 48000 // output samples per second
+#define APU_BUF 4096 // stereo samples held between reads, the oldest are dropped past that
+#define APU_PHASES 32
+#define APU_TAPS 16
+#define APU_FS_CYCLES 2048 // m-cycles between frame sequencer steps, 512Hz
+
+// square 1, square 2, wave and noise
+typedef struct {
+    bool on;
+    uint16_t len; // counts down while length is enabled, the channel stops at 0
+    uint8_t vol, env_timer;
+    // only kept up to date while there is an output to synthesize into
+    uint32_t timer; // clocks until the waveform steps
+    uint8_t pos; // duty step or wave sample
+    uint8_t out; // the level it is putting out, 0-15
+} apu_channel;
+
+// the channels are band-limited into these as steps at the exact clock they change on,
+// which resamples to APU_RATE without aliasing
+typedef struct {
+    uint64_t frac; // where 'time' falls in 'buf', in samples << 32
+    int32_t buf[2][APU_BUF + APU_TAPS]; // left and right
+    int32_t level[2]; // what the steps so far add up to
+    int32_t sum[2], dc[2]; // integrators and the high pass that takes out the dc offset
+} apu_out;
+
+// nothing is ticked, the apu catches up to the clock when a register is accessed or samples are
+// taken. without an output only lengths, envelopes and sweep run, at the frame sequencer's 512Hz
+typedef struct {
+    uint64_t time; // when everything was last brought up to date
+    uint64_t fs_time; // when the frame sequencer steps next
+    uint8_t fs_step;
+    uint8_t regs[0x20]; // ff10-ff2f as written
+    uint8_t wave[0x10];
+    apu_channel ch[4];
+    uint16_t shadow; // sweep's copy of square 1's frequency
+    uint8_t sweep_timer;
+    bool sweep_on;
+    uint16_t lfsr;
+    apu_out *out; // NULL unless apu_use_output turned synthesis on
+} apu;
+
+void apu_init(apu *self, sched *sched);
+void apu_deinit(apu *self);
+// starts or stops synthesizing from the current time, returns false if the buffer can't be allocated
+bool apu_use_output(apu *self, sched *sched, bool on);
+uint8_t apu_read(apu *self, sched *sched, uint16_t addr);
+void apu_write(apu *self, sched *sched, uint16_t addr, uint8_t val);
+// catches up to 'now' and takes up to 'max' interleaved left/right samples, returns how many
+size_t apu_samples(apu *self, uint64_t now, int16_t *out, size_t max);
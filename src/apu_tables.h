@@ -0,0 +1,37 @@
+// band-limited step for apu.c, 32 phases of the fraction of a sample the step falls at
+// by 16 taps. each row is a blackman windowed sinc cut off at 0.9 of the nyquist
+// frequency centred 8 taps in, scaled so it sums to exactly 1 << 15
+static const int16_t apu_kernel[APU_PHASES][APU_TAPS] = {
+    {0, 18, -110, 359, -843, 1561, -2371, 3025, 29490, 3025, -2371, 1561, -843, 359, -110, 18},
+    {0, 17, -108, 347, -795, 1421, -2025, 2117, 29452, 3974, -2714, 1693, -887, 369, -111, 18},
+    {0, 17, -105, 332, -742, 1276, -1679, 1252, 29332, 4960, -3051, 1818, -925, 376, -110, 17},
+    {0, 16, -102, 315, -686, 1128, -1335, 434, 29131, 5981, -3378, 1932, -956, 380, -109, 17},
+    {0, 16, -98, 297, -627, 977, -997, -336, 28853, 7031, -3693, 2036, -982, 381, -106, 16},
+    {0, 15, -93, 277, -566, 824, -665, -1055, 28499, 8106, -3992, 2127, -999, 378, -103, 15},
+    {0, 14, -87, 256, -503, 672, -343, -1721, 28067, 9203, -4273, 2204, -1009, 372, -97, 13},
+    {0, 13, -82, 234, -439, 522, -34, -2334, 27565, 10317, -4531, 2266, -1011, 362, -91, 11},
+    {0, 12, -76, 211, -375, 374, 262, -2891, 26992, 11444, -4765, 2311, -1004, 348, -83, 8},
+    {0, 10, -69, 188, -311, 229, 543, -3394, 26350, 12577, -4970, 2339, -987, 330, -73, 6},
+    {0, 9, -63, 165, -248, 90, 807, -3840, 25644, 13713, -5144, 2349, -962, 308, -62, 2},
+    {0, 8, -57, 142, -186, -44, 1052, -4231, 24880, 14845, -5284, 2338, -926, 282, -50, -1},
+    {0, 7, -50, 119, -126, -171, 1277, -4566, 24058, 15970, -5386, 2307, -881, 251, -36, -5},
+    {0, 6, -44, 96, -68, -291, 1482, -4846, 23184, 17082, -5448, 2255, -826, 217, -21, -10},
+    {0, 5, -37, 74, -12, -403, 1666, -5072, 22258, 18175, -5467, 2182, -760, 178, -4, -15},
+    {0, 4, -31, 53, 41, -506, 1829, -5246, 21291, 19244, -5442, 2086, -685, 136, 14, -20},
+    {0, 3, -25, 33, 90, -600, 1969, -5369, 20284, 20285, -5369, 1969, -600, 90, 33, -25},
+    {0, 3, -20, 14, 136, -685, 2087, -5442, 19245, 21290, -5246, 1829, -506, 41, 53, -31},
+    {0, 2, -15, -4, 178, -760, 2182, -5468, 18176, 22261, -5073, 1667, -403, -12, 74, -37},
+    {0, 2, -10, -21, 217, -826, 2256, -5449, 17084, 23186, -4847, 1483, -291, -68, 96, -44},
+    {0, 1, -5, -36, 251, -881, 2308, -5387, 15973, 24061, -4567, 1278, -171, -126, 119, -50},
+    {0, 1, -1, -50, 282, -926, 2339, -5285, 14849, 24884, -4232, 1052, -44, -186, 142, -57},
+    {0, 0, 2, -62, 308, -962, 2349, -5146, 13716, 25653, -3841, 807, 90, -248, 165, -63},
+    {0, 0, 6, -73, 330, -988, 2340, -4972, 12581, 26359, -3395, 543, 229, -311, 188, -69},
+    {0, 0, 8, -83, 348, -1004, 2312, -4767, 11448, 27001, -2892, 263, 374, -375, 211, -76},
+    {0, 0, 11, -91, 362, -1011, 2267, -4533, 10321, 27577, -2335, -34, 522, -440, 234, -82},
+    {0, 0, 13, -97, 372, -1010, 2205, -4274, 9207, 28080, -1722, -344, 673, -503, 256, -88},
+    {0, 0, 15, -103, 378, -1000, 2128, -3994, 8110, 28511, -1055, -665, 825, -566, 277, -93},
+    {0, 0, 16, -107, 381, -982, 2037, -3694, 7034, 28868, -336, -997, 977, -628, 297, -98},
+    {0, 0, 17, -109, 380, -957, 1933, -3379, 5984, 29147, 434, -1336, 1128, -687, 315, -102},
+    {0, 0, 17, -111, 376, -925, 1819, -3052, 4963, 29347, 1253, -1680, 1277, -743, 332, -105},
+    {0, 0, 18, -111, 369, -887, 1694, -2715, 3976, 29467, 2118, -2027, 1422, -795, 347, -108},
+};
@@ -0,0 +1,401 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "link.h"
+#include "movie.h"
+#include "rom.h"
+
+#define SERIAL_MAX 4096
+
+// one emulator instance, the rom is shared by every seed of the same file
+typedef struct {
+    const char *path;
+    const uint8_t *rom;
+    const movie *movie; // the input played in each frame, NULL for none
+    uint64_t seed;
+    // results
+    bool locked_up;
+    bool mismatched; // the jit disagreed with the interpreter in check mode
+    bool unlinked; // the other end of the cable couldn't be started, nothing was run
+    uint16_t af, bc, de, hl, sp, pc;
+    uint64_t cycles, insts, frames, frame_hash;
+    size_t serial_len;
+    char serial[SERIAL_MAX];
+} job;
+
+// each worker runs jobs from the front of its own range and steals
+// the back half of someone else's once it runs dry
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head, tail;
+} queue;
+
+typedef struct {
+    job *jobs;
+    queue *queues;
+    int workers;
+    uint64_t frames;
+    const uint8_t *link_rom; // every run is linked to an instance of it, NULL for none
+    const char *save_dir;
+    bool blocks, jit, jit_check, accurate;
+} pool;
+
+typedef struct {
+    pool *pool;
+    int id;
+} worker;
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void serial_record(void *ctx, uint8_t byte) {
+    job *j = ctx;
+    if (j->serial_len < SERIAL_MAX)
+        j->serial[j->serial_len++] = byte;
+}
+
+static void job_run(job *j, const pool *p) {
+    sm83 cpu;
+    sm83_init(&cpu, NULL, j->rom);
+    cpu.accurate = p->accurate;
+    if (p->blocks)
+        sm83_use_blocks(&cpu, true); // falls back to the interpreter if it can't be allocated
+#ifdef SM83_JIT
+    if (p->jit)
+        sm83_use_jit(&cpu, true, p->jit_check); // the same, or to the block cache without the jit
+#endif
+    // each run gets its own .sav, mapped so a killed worker still leaves it up to date
+    uint8_t *sav = NULL;
+    size_t sav_size = cpu.mmu->cram_size;
+    if (p->save_dir && cpu.mmu->mbc.battery) {
+        char path[4096];
+        const char *slash = strrchr(j->path, '/');
+        snprintf(path, sizeof(path), "%s/%s-%llu.sav", p->save_dir, slash ? slash + 1 : j->path,
+            (unsigned long long)j->seed);
+        if ((sav = sav_open(path, sav_size)))
+            mmu_use_cart_ram(cpu.mmu, sav);
+        else
+            fprintf(stderr, "Unable to open save file \"%s\"\n", path);
+    }
+    cpu.mmu->serial_out = serial_record;
+    cpu.mmu->serial_ctx = j;
+    if (j->seed) {
+        // seeds stand in for the random contents ram has at power on
+        uint64_t state = j->seed;
+        for (uint16_t i = 0; i < 0x2000; ++i)
+            mmu_write8(cpu.mmu, 0xc000 + i, splitmix64(&state));
+        for (size_t i = 0; i < 0x7f; ++i) // leave interrupt enable alone
+            cpu.mmu->hram[i] = splitmix64(&state);
+    }
+
+    // the other end of the cable runs on a thread of its own, nothing is recorded from it
+    sm83 other;
+    link_cable cable;
+    if (p->link_rom) {
+        sm83_init(&other, NULL, p->link_rom);
+        other.accurate = p->accurate;
+        if (!link_cable_init(&cable, &cpu, &other)) {
+            sm83_deinit(&other);
+            j->unlinked = true;
+        }
+    }
+
+    for (uint64_t i = 0; i < p->frames && !sm83_locked_up(&cpu) && !j->unlinked; ++i) {
+        if (j->movie)
+            mmu_set_buttons(cpu.mmu, movie_input(j->movie, i));
+        if (p->link_rom)
+            link_cable_run(&cable, FRAME_CYCLES);
+        else
+            sm83_run(&cpu, FRAME_CYCLES);
+    }
+    if (p->link_rom && !j->unlinked) {
+        link_cable_deinit(&cable);
+        sm83_deinit(&other);
+    }
+
+    j->locked_up = sm83_locked_up(&cpu);
+    j->af = cpu.af.pair;
+    j->bc = cpu.bc.pair;
+    j->de = cpu.de.pair;
+    j->hl = cpu.hl.pair;
+    j->sp = cpu.sp;
+    j->pc = cpu.pc;
+    j->cycles = cpu.mmu->sched.now;
+    j->insts = cpu.insts;
+    j->frames = cpu.mmu->ppu.frames;
+    j->frame_hash = ppu_frame_hash(&cpu.mmu->ppu);
+#ifdef SM83_JIT
+    j->mismatched = cpu.jit && cpu.jit->mismatches;
+#endif
+    sm83_deinit(&cpu);
+    if (sav)
+        sav_close(sav, sav_size);
+}
+
+// moves the back half of another worker's range into our own, false once everyone is empty
+static bool steal(pool *p, int id) {
+    queue *own = &p->queues[id];
+    for (int i = 1; i < p->workers; ++i) {
+        queue *victim = &p->queues[(id + i) % p->workers];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->tail - victim->head;
+        if (left) {
+            size_t take = (left + 1) / 2;
+            victim->tail -= take;
+            pthread_mutex_lock(&own->lock);
+            own->head = victim->tail;
+            own->tail = victim->tail + take;
+            pthread_mutex_unlock(&own->lock);
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (left)
+            return true;
+    }
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    worker *w = arg;
+    pool *p = w->pool;
+    queue *own = &p->queues[w->id];
+    for (;;) {
+        pthread_mutex_lock(&own->lock);
+        bool have = own->head < own->tail;
+        size_t next = own->head;
+        if (have)
+            ++own->head;
+        pthread_mutex_unlock(&own->lock);
+        if (have && p->jobs[next].rom) // roms that failed to load are only reported
+            job_run(&p->jobs[next], p);
+        else if (!have && !steal(p, w->id))
+            return NULL;
+    }
+}
+
+static void print_escaped(FILE *out, const char *s, size_t len) {
+    fputc('"', out);
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", out);
+        else if (c < 0x20 || c >= 0x7f)
+            fprintf(out, "\\x%02x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char **argv) {
+    const char *help = "gameboff-batch [options] rom...\n"
+                       "Options:\n"
+                       "    -l [file]    Also run every rom listed in 'file', one path per line\n"
+                       "    -s [seeds]   Run each rom 'seeds' times with seeded random power on ram (default once, zeroed)\n"
+                       "    -f [frames]  Frames to run each instance for unless it locks up first (default 3600, or the movie's length)\n"
+                       "    -M [file]    Play the input movie 'file' into every run, roms it wasn't recorded on are skipped\n"
+                       "    -L [rom]     Link every run to an instance of 'rom' over a cable, on a thread of its own\n"
+                       "    -j [threads] Number of worker threads (default one per core)\n"
+                       "    -o [file]    Write the results to 'file' instead of stdout\n"
+                       "    -S [dir]     Keep battery backed ram of each run in 'dir' as rom-seed.sav\n"
+                       "    -B           Run from the cache of decoded blocks, the results are the same\n"
+                       "    -J           Compile hot blocks to x86-64, the results are the same (needs -Djit=true)\n"
+                       "    -D           Like -J but check every compiled block against the interpreter, fails on a mismatch\n"
+                       "    -A           Give every memory access its own m-cycle, slower but right for timing sensitive roms\n"
+                       "    -h           Returns help menu\n";
+    const char *list = NULL, *out_path = NULL, *save_dir = NULL, *movie_path = NULL, *link_path = NULL;
+    uint64_t seeds = 0, frames = 0;
+    bool blocks = false, jit = false, jit_check = false, accurate = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "l:s:f:M:L:j:o:S:BJDAh")) != -1) {
+        switch (opt) {
+            case 'l':
+                list = optarg;
+                break;
+            case 's':
+                seeds = strtoull(optarg, NULL, 0);
+                break;
+            case 'f':
+                frames = strtoull(optarg, NULL, 0);
+                break;
+            case 'M':
+                movie_path = optarg;
+                break;
+            case 'L':
+                link_path = optarg;
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 0);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'S':
+                save_dir = optarg;
+                break;
+            case 'B':
+                blocks = true;
+                break;
+            case 'D':
+                jit_check = true;
+                // fallthrough
+            case 'J':
+                jit = true;
+                break;
+            case 'A':
+                accurate = true;
+                break;
+            case 'h':
+                fprintf(stderr, "%s", help);
+                return 0;
+            default:
+                fprintf(stderr, "%s", help);
+                return 1;
+        }
+    }
+
+#ifndef SM83_JIT
+    if (jit) {
+        fprintf(stderr, "The jit needs a build with -Djit=true\n");
+        return 1;
+    }
+#endif
+
+    // gather rom paths from the command line and the list file
+    size_t rom_count = argc - optind, rom_cap = rom_count + 16;
+    char **paths = malloc(rom_cap * sizeof(*paths));
+    for (size_t i = 0; i < rom_count; ++i)
+        paths[i] = strdup(argv[optind + i]);
+    if (list) {
+        FILE *list_f = fopen(list, "r");
+        if (!list_f) {
+            fprintf(stderr, "Unable to read rom list \"%s\"\n", list);
+            return 1;
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), list_f)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (!line[0])
+                continue;
+            if (rom_count == rom_cap)
+                paths = realloc(paths, (rom_cap *= 2) * sizeof(*paths));
+            paths[rom_count++] = strdup(line);
+        }
+        fclose(list_f);
+    }
+    if (!rom_count) {
+        fprintf(stderr, "No ROM path specified\n%s", help);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (out_path && !(out = fopen(out_path, "w"))) {
+        fprintf(stderr, "Unable to write results to \"%s\"\n", out_path);
+        return 1;
+    }
+
+    // every rom is mapped once and shared read only by all of its instances
+    rom_image *roms = calloc(rom_count, sizeof(*roms));
+    movie *movies = calloc(rom_count, sizeof(*movies)); // checked against each rom
+    for (size_t i = 0; i < rom_count; ++i) {
+        if (!rom_open(&roms[i], paths[i])) {
+            fprintf(stderr, "Unable to read rom \"%s\", skipping it\n", paths[i]);
+        } else if (movie_path && !movie_load(&movies[i], movie_path, roms[i].data)) {
+            fprintf(stderr, "Unable to play movie \"%s\" on rom \"%s\", skipping it\n", movie_path, paths[i]);
+            rom_close(&roms[i]);
+            roms[i].data = NULL;
+        } else if (movie_path && !frames) {
+            frames = movies[i].frames;
+        }
+    }
+    if (!frames)
+        frames = 3600;
+
+    rom_image link_rom = {0};
+    if (link_path && !rom_open(&link_rom, link_path)) {
+        fprintf(stderr, "Unable to read rom \"%s\"\n", link_path);
+        return 1;
+    }
+
+    size_t runs = seeds ? seeds : 1, job_count = rom_count * runs;
+    job *jobs = calloc(job_count, sizeof(*jobs));
+    for (size_t i = 0; i < job_count; ++i) {
+        jobs[i].path = paths[i / runs];
+        jobs[i].rom = roms[i / runs].data;
+        jobs[i].movie = movie_path ? &movies[i / runs] : NULL;
+        jobs[i].seed = seeds ? i % runs + 1 : 0;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > job_count)
+        threads = job_count;
+    pool p = {jobs, malloc(threads * sizeof(queue)), threads, frames, link_rom.data, save_dir, blocks, jit, jit_check,
+        accurate};
+    pthread_t *tids = malloc(threads * sizeof(*tids));
+    worker *workers = malloc(threads * sizeof(*workers));
+    // start everyone with an even share, stealing evens out roms that run long
+    for (long i = 0; i < threads; ++i) {
+        pthread_mutex_init(&p.queues[i].lock, NULL);
+        p.queues[i].head = job_count * i / threads;
+        p.queues[i].tail = job_count * (i + 1) / threads;
+    }
+    for (long i = 0; i < threads; ++i) {
+        workers[i] = (worker){&p, i};
+        pthread_create(&tids[i], NULL, worker_main, &workers[i]);
+    }
+    for (long i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+
+    int status = 0;
+    fprintf(out, "rom\tseed\tresult\tcycles\tinsts\tframes\taf\tbc\tde\thl\tsp\tpc\tframe_hash\tserial\n");
+    for (size_t i = 0; i < job_count; ++i) {
+        job *j = &jobs[i];
+        fprintf(out, "%s\t%llu\t", j->path, (unsigned long long)j->seed);
+        if (!j->rom || j->unlinked) {
+            fprintf(out, j->rom ? "unlinked\n" : "unreadable\n");
+            status = 1;
+            continue;
+        }
+        fprintf(out, "%s\t%llu\t%llu\t%llu\t%04x\t%04x\t%04x\t%04x\t%04x\t%04x\t%016llx\t",
+            j->locked_up ? "locked_up" : "timeout", (unsigned long long)j->cycles, (unsigned long long)j->insts,
+            (unsigned long long)j->frames, j->af, j->bc, j->de, j->hl, j->sp, j->pc,
+            (unsigned long long)j->frame_hash);
+        print_escaped(out, j->serial, j->serial_len);
+        fputc('\n', out);
+        status |= j->mismatched;
+    }
+
+    if (out != stdout)
+        fclose(out);
+    for (long i = 0; i < threads; ++i)
+        pthread_mutex_destroy(&p.queues[i].lock);
+    for (size_t i = 0; i < rom_count; ++i) {
+        if (roms[i].data)
+            rom_close(&roms[i]);
+        movie_free(&movies[i]);
+        free(paths[i]);
+    }
+    free(movies);
+    if (link_rom.data)
+        rom_close(&link_rom);
+    free(workers);
+    free(tids);
+    free(p.queues);
+    free(jobs);
+    free(roms);
+    free(paths);
+    return status;
+}
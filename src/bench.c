@@ -0,0 +1,429 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "rewind.h"
+#include "rom.h"
+#include "state.h"
+
+#define SERIAL_MAX 4096
+#define REWIND_BYTES (8 << 20) // the same as the window's default
+
+typedef struct {
+    size_t len;
+    char buf[SERIAL_MAX + 1];
+} serial_log;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void serial_record(void *ctx, uint8_t byte) {
+    serial_log *log = ctx;
+    if (log->len < SERIAL_MAX) {
+        log->buf[log->len++] = byte ? byte : ' ';
+        log->buf[log->len] = '\0';
+    }
+}
+
+// 1 passed, -1 failed, 0 still running, going by what the common test suites report
+static int test_result(sm83 *cpu, const serial_log *log) {
+    // blargg's roms print the result over serial
+    if (strstr(log->buf, "Passed"))
+        return 1;
+    if (strstr(log->buf, "Failed"))
+        return -1;
+    // mooneye's leave fibonacci numbers in the registers, or 0x42 everywhere on failure
+    if (cpu->bc.pair == 0x0305 && cpu->de.pair == 0x080d && cpu->hl.pair == 0x1522)
+        return 1;
+    if (cpu->bc.pair == 0x4242 && cpu->de.pair == 0x4242 && cpu->hl.pair == 0x4242)
+        return -1;
+    // blargg's newer roms also sign cart ram with de b0 61 and put the result code at 0xa000
+    _mmu *mmu = cpu->mmu;
+    if (mmu_read8(mmu, 0xa001) == 0xde && mmu_read8(mmu, 0xa002) == 0xb0 && mmu_read8(mmu, 0xa003) == 0x61) {
+        uint8_t status = mmu_read8(mmu, 0xa000);
+        if (status != 0x80)
+            return status ? -1 : 1;
+    }
+    return 0;
+}
+
+// what a frontend would do with the audio, nothing without -a
+static void take_audio(sm83 *cpu) {
+    int16_t buf[2 * 1024];
+    while (apu_samples(&cpu->mmu->apu, cpu->mmu->sched.now, buf, 1024) == 1024)
+        ;
+}
+
+// a frontend's rewind history, timed on its own. nothing without -w
+static void take_rewind(rewind_ring *rewind, sm83 *cpu, uint64_t *states, double *time) {
+    if (!rewind)
+        return;
+    double start = now_sec();
+    uint32_t wait = rewind->wait;
+    rewind_tick(rewind, cpu);
+    if (rewind->wait <= wait)
+        ++*states;
+    *time += now_sec() - start;
+}
+
+// ways a state can be corrupted that loading has to catch, each done to a running instance before saving
+static void bad_rom0(sm83 *cpu) {
+    cpu->mmu->mbc.rom0 = cpu->mmu->mbc.rom_banks;
+}
+
+static void bad_romx(sm83 *cpu) {
+    cpu->mmu->mbc.romx = cpu->mmu->mbc.rom_banks;
+}
+
+static void bad_queue_len(sm83 *cpu) {
+    cpu->mmu->sched.len = EV_COUNT + 1;
+}
+
+static void bad_event(sm83 *cpu) {
+    cpu->mmu->sched.len = 1;
+    cpu->mmu->sched.queue[0].ev = EV_COUNT;
+}
+
+static void repeated_event(sm83 *cpu) {
+    cpu->mmu->sched.len = 2;
+    cpu->mmu->sched.queue[0].ev = cpu->mmu->sched.queue[1].ev = EV_TIMER;
+}
+
+static void apu_behind(sm83 *cpu) {
+    cpu->mmu->apu.time = cpu->mmu->apu.fs_time + 1;
+}
+
+static void apu_ahead(sm83 *cpu) {
+    cpu->mmu->apu.fs_time = cpu->mmu->apu.time + APU_FS_CYCLES + 1;
+}
+
+static void bad_wave_pos(sm83 *cpu) {
+    cpu->mmu->apu.ch[2].pos = 32;
+}
+
+static void bad_duty_pos(sm83 *cpu) {
+    cpu->mmu->apu.ch[0].pos = 8;
+}
+
+static const struct {
+    const char *name;
+    void (*corrupt)(sm83 *cpu);
+} bad_states[] = {
+    {"rom0 past the end of the rom", bad_rom0},
+    {"romx past the end of the rom", bad_romx},
+    {"event queue longer than the events", bad_queue_len},
+    {"unknown event", bad_event},
+    {"event queued twice", repeated_event},
+    {"audio synthesized past the frame sequencer", apu_behind},
+    {"frame sequencer more than a step ahead", apu_ahead},
+    {"wave position past its 32 samples", bad_wave_pos},
+    {"duty position past its 8 steps", bad_duty_pos},
+};
+
+// every corrupt state has to be rejected and leave 'cpu' as it was, a good one has to load.
+// returns false if any of them didn't
+static bool check_states(sm83 *cpu) {
+    size_t size = gameboff_state_size(cpu);
+    uint8_t *good = malloc(size), *bad = malloc(size), *after = malloc(size);
+    if (!good || !bad || !after) {
+        fprintf(stderr, "Unable to allocate the states\n");
+        free(good);
+        free(bad);
+        free(after);
+        return false;
+    }
+    bool ok = true;
+    gameboff_save_state(cpu, good, size);
+    for (size_t i = 0; i < sizeof(bad_states) / sizeof(bad_states[0]); ++i) {
+        bad_states[i].corrupt(cpu);
+        gameboff_save_state(cpu, bad, size);
+        gameboff_load_state(cpu, good, size);
+        bool loaded = gameboff_load_state(cpu, bad, size);
+        gameboff_save_state(cpu, after, size);
+        bool touched = memcmp(after, good, size);
+        printf("%s: %s\n", bad_states[i].name, loaded ? "loaded" : touched ? "rejected but changed" : "rejected");
+        ok &= !loaded && !touched;
+        gameboff_load_state(cpu, good, size);
+    }
+    bool loads = gameboff_load_state(cpu, good, size);
+    printf("good state: %s\n", loads ? "loaded" : "rejected");
+    free(good);
+    free(bad);
+    free(after);
+    return ok && loads;
+}
+
+int main(int argc, char **argv) {
+    const char *help = "gameboff-bench [options] rom\n"
+                       "Options:\n"
+                       "    -n [count]   Number of instructions to execute (default 100000000)\n"
+                       "    -r [frames]  Only time the ppu, rendering 'frames' frames of whatever the rom shows first\n"
+                       "    -k [count]   Only time forking, 'count' copies of the rom's state that each run a frame\n"
+                       "    -T           Turn the decoded tile cache off\n"
+                       "    -B           Run from the cache of decoded blocks instead of fetching every byte\n"
+                       "    -J           Compile hot blocks to x86-64 (needs -Djit=true)\n"
+                       "    -D           Like -J but check every compiled block against the interpreter, fails on a mismatch\n"
+                       "    -A           Give every memory access its own m-cycle, slower but right for timing sensitive roms\n"
+                       "    -a           Synthesize audio too, taken every frame like the window does\n"
+                       "    -w [frames]  Take a rewind state every 'frames' frames too, and report what they cost\n"
+                       "    -s           Check that corrupt save states are rejected, the exit code is the result\n"
+                       "    -c           Run a test rom until it reports passing or failing, the exit code is the result\n"
+                       "    -f [frames]  Give up on a test rom after 'frames' frames (default 7200)\n"
+                       "    -p [file]    Write the opcode and pc profile to 'file', csv or .json (needs -Dprofile=true)\n"
+                       "    -h           Returns help menu\n";
+    uint64_t count = 100000000, render_frames = 0, test_frames = 7200, forks = 0, rewind_frames = 0;
+    bool tile_cache = true, test = false, states = false, blocks = false, jit = false, jit_check = false, accurate = false, audio = false;
+    const char *profile_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:k:TBJDAaw:scf:p:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                render_frames = strtoull(optarg, NULL, 0);
+                break;
+            case 'k':
+                forks = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                tile_cache = false;
+                break;
+            case 'B':
+                blocks = true;
+                break;
+            case 'D':
+                jit_check = true;
+                // fallthrough
+            case 'J':
+                jit = true;
+                break;
+            case 'A':
+                accurate = true;
+                break;
+            case 'a':
+                audio = true;
+                break;
+            case 'w':
+                rewind_frames = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                states = true;
+                break;
+            case 'c':
+                test = true;
+                break;
+            case 'f':
+                test_frames = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                profile_path = optarg;
+                break;
+            case 'h':
+                fprintf(stderr, "%s", help);
+                return 0;
+            default:
+                fprintf(stderr, "%s", help);
+                return 1;
+        }
+    }
+#ifndef SM83_PROFILE
+    if (profile_path) {
+        fprintf(stderr, "Profiling needs a build with -Dprofile=true\n");
+        return 1;
+    }
+#endif
+#ifndef SM83_JIT
+    (void)jit_check;
+    if (jit) {
+        fprintf(stderr, "The jit needs a build with -Djit=true\n");
+        return 1;
+    }
+#endif
+    if (optind != argc - 1) {
+        fprintf(stderr, "No ROM path specified\n%s", help);
+        return 1;
+    }
+
+    rom_image rom;
+    if (!rom_open(&rom, argv[optind])) {
+        fprintf(stderr, "Unable to read rom \"%s\"\n", argv[optind]);
+        return 1;
+    }
+
+    sm83 cpu;
+    sm83_init(&cpu, NULL, rom.data);
+    cpu.mmu->ppu.tile_cache = tile_cache;
+    cpu.accurate = accurate;
+    if (audio && !apu_use_output(&cpu.mmu->apu, &cpu.mmu->sched, true)) {
+        fprintf(stderr, "Unable to allocate the audio buffer\n");
+        return 1;
+    }
+    if (blocks && !sm83_use_blocks(&cpu, true)) {
+        fprintf(stderr, "Unable to allocate the block cache\n");
+        return 1;
+    }
+#ifdef SM83_JIT
+    if (jit && !sm83_use_jit(&cpu, true, jit_check)) {
+        fprintf(stderr, "Unable to set up the jit: %s\n", strerror(errno));
+        return 1;
+    }
+#endif
+
+    if (render_frames) {
+        // let the rom get as far as its first frame to set up vram
+        sched *sched = &cpu.mmu->sched;
+        while (!cpu.mmu->ppu.frames && sched->now < 60 * FRAME_CYCLES)
+            sm83_run(&cpu, FRAME_CYCLES);
+        if (!cpu.mmu->ppu.frames) {
+            fprintf(stderr, "The rom never switched the lcd on, nothing to render\n");
+            return 1;
+        }
+        // hop from event to event without the cpu, touching a few tiles every
+        // frame like a game would so the cache has some decoding to do
+        uint64_t frame = cpu.mmu->ppu.frames, end = frame + render_frames, seed = 1;
+        double start = now_sec();
+        while (cpu.mmu->ppu.frames < end) {
+            sched->now = sched->next;
+            mmu_events(cpu.mmu);
+            if (cpu.mmu->ppu.frames != frame) {
+                frame = cpu.mmu->ppu.frames;
+                for (int i = 0; i < 32; ++i) {
+                    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                    mmu_write8(cpu.mmu, 0x8000 + (seed >> 33) % 0x1800, seed >> 56);
+                }
+            }
+        }
+        double elapsed = now_sec() - start;
+        printf("%s: %llu frames rendered in %.3fs, tile cache %s\n", argv[optind],
+            (unsigned long long)render_frames, elapsed, tile_cache ? "on" : "off");
+        printf("%.1f frames per second\n", render_frames / elapsed);
+        sm83_deinit(&cpu);
+        rom_close(&rom);
+        return 0;
+    }
+
+    if (states) {
+        // the rom gets going first so the state has something in it
+        for (int i = 0; i < 60 && !sm83_locked_up(&cpu); ++i)
+            sm83_run(&cpu, FRAME_CYCLES);
+        bool ok = check_states(&cpu);
+        printf("%s: save states %s\n", argv[optind], ok ? "checked" : "FAILED");
+        sm83_deinit(&cpu);
+        rom_close(&rom);
+        return ok ? 0 : 1;
+    }
+
+    if (forks) {
+        // the rom gets going first so there is something in ram to share
+        for (int i = 0; i < 60 && !sm83_locked_up(&cpu); ++i)
+            sm83_run(&cpu, FRAME_CYCLES);
+        sm83 *children = malloc(forks * sizeof(sm83));
+        if (!children) {
+            fprintf(stderr, "Unable to allocate %llu forks\n", (unsigned long long)forks);
+            return 1;
+        }
+        double start = now_sec();
+        for (uint64_t i = 0; i < forks; ++i)
+            sm83_fork(&children[i], &cpu);
+        double forked = now_sec() - start;
+        for (uint64_t i = 0; i < forks; ++i)
+            sm83_run(&children[i], FRAME_CYCLES);
+        double ran = now_sec() - start - forked;
+        // the pages each child ended up copying by writing to them
+        uint64_t copied = 0;
+        for (uint64_t i = 0; i < forks; ++i) {
+            _mmu *mmu = children[i].mmu;
+            for (int j = 0; j < 0x2000 >> PAGE_SHIFT; ++j)
+                copied += (mmu->wram[j] != cpu.mmu->wram[j]) + (mmu->ppu.vram[j] != cpu.mmu->ppu.vram[j]);
+            for (uint32_t j = 0; j < mmu->cram_size >> PAGE_SHIFT; ++j)
+                copied += mmu->cram[j] != cpu.mmu->cram[j];
+        }
+        printf("%s: %llu forks in %.3fs, %.2fus each\n", argv[optind], (unsigned long long)forks, forked,
+            forked / forks * 1e6);
+        printf("a frame each in %.3fs, %.1f pages (%.1fKB) copied per fork\n", ran, (double)copied / forks,
+            (double)copied / forks * PAGE_SIZE / 1024);
+        for (uint64_t i = 0; i < forks; ++i)
+            sm83_deinit(&children[i]);
+        free(children);
+        sm83_deinit(&cpu);
+        rom_close(&rom);
+        return 0;
+    }
+
+    serial_log log = {0};
+    cpu.mmu->serial_out = serial_record;
+    cpu.mmu->serial_ctx = &log;
+    int result = 0;
+    rewind_ring *rewind = NULL;
+    if (rewind_frames && !(rewind = rewind_new(&cpu, REWIND_BYTES, rewind_frames))) {
+        fprintf(stderr, "Unable to allocate the rewind history\n");
+        return 1;
+    }
+    uint64_t rewind_states = 0;
+    double rewind_time = 0;
+
+    // run a frame at a time and stop at the first frame boundary past the count,
+    // test roms are checked every frame until they report
+    double start = now_sec();
+    if (test) {
+        for (uint64_t i = 0; i < test_frames && !result && !sm83_locked_up(&cpu); ++i) {
+            sm83_run(&cpu, FRAME_CYCLES);
+            take_audio(&cpu);
+            take_rewind(rewind, &cpu, &rewind_states, &rewind_time);
+            result = test_result(&cpu, &log);
+        }
+    } else {
+        while (cpu.insts < count && !sm83_locked_up(&cpu)) {
+            sm83_run(&cpu, FRAME_CYCLES);
+            take_audio(&cpu);
+            take_rewind(rewind, &cpu, &rewind_states, &rewind_time);
+        }
+    }
+    double elapsed = now_sec() - start;
+    uint64_t insts = cpu.insts, cycles = cpu.mmu->sched.now;
+
+#ifdef SM83_PROFILE
+    if (profile_path && !profile_dump(cpu.prof, profile_path))
+        fprintf(stderr, "Unable to write profile \"%s\"\n", profile_path);
+#endif
+    if (test)
+        printf("%s: %s\n", argv[optind], result > 0 ? "passed" : result < 0 ? "failed" : "no result");
+    if (test && result <= 0 && log.len)
+        printf("serial output: %s\n", log.buf);
+
+    // an m-cycle is 4 clocks of the 4.194304MHz master clock
+    printf("%s: %llu instructions, %llu M-cycles in %.3fs\n", argv[optind],
+        (unsigned long long)insts, (unsigned long long)cycles, elapsed);
+    printf("%.2f MIPS, %.2fx real time, %.1f frames per second\n", insts / elapsed / 1e6,
+        cycles / elapsed / 1048576.0, cpu.mmu->ppu.frames / elapsed);
+    if (rewind) {
+        // it only fills up once the oldest start getting dropped, so this is what's held so far
+        printf("rewind: %llu states, %.1fus each, %.0f bytes each, %zu held in %.1fKB, %.1fs of history\n",
+            (unsigned long long)rewind_states, rewind_time / rewind_states * 1e6,
+            (double)rewind_used(rewind) / rewind->count, rewind->count, rewind_used(rewind) / 1024.0,
+            rewind->count * rewind_frames * FRAME_CYCLES / 1048576.0);
+        rewind_free(rewind);
+    }
+    bool mismatched = false;
+#ifdef SM83_JIT
+    if (cpu.jit) {
+        printf("jit: %llu blocks compiled, %llu flushes, %llu mismatches\n", (unsigned long long)cpu.jit->compiled,
+            (unsigned long long)cpu.jit->flushes, (unsigned long long)cpu.jit->mismatches);
+        mismatched = cpu.jit->mismatches;
+    }
+#endif
+
+    sm83_deinit(&cpu);
+    rom_close(&rom);
+    return (test && result <= 0) || mismatched;
+}
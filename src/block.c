@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "block.h"
+
+// stop is treated as 1 byte like the interpreter does
+uint8_t block_op_size(uint8_t op) {
+    switch (op) {
+        case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e: // ld r, n8
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr
+        case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe: // alu a, n8
+        case 0xe0: case 0xf0: case 0xe8: case 0xf8: case 0xcb:
+            return 2;
+        case 0x01: case 0x11: case 0x21: case 0x31: case 0x08: // ld rr, n16 and ld [a16], sp
+        case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: // jp
+        case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc: // call
+        case 0xea: case 0xfa:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+// anything that may not carry on to the next instruction ends a block
+static bool block_op_ends(uint8_t op) {
+    switch (op) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr
+        case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe9: // jp
+        case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc: // call
+        case 0xc0: case 0xc8: case 0xc9: case 0xd0: case 0xd8: case 0xd9: // ret
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff: // rst
+        case 0x10: case 0x76: case 0xfb: // stop, halt, ei
+        case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4: case 0xeb: case 0xec: case 0xed: case 0xf4: case 0xfc:
+        case 0xfd: // unused
+            return true;
+        default:
+            return false;
+    }
+}
+
+block_cache *block_cache_new(void) {
+    return calloc(1, sizeof(block_cache));
+}
+
+void block_cache_free(block_cache *self) {
+    free(self);
+}
+
+block *block_decode(block *b, _mmu *mmu, uint16_t pc, uint16_t bank, uint32_t gen) {
+    // the bootrom is only there until it unmaps itself, so it is never cached
+    uint32_t limit = pc < 0x4000 ? 0x4000 : 0x8000;
+    if (pc < 0x100 && mmu->bootrom && !mmu->io[0x50])
+        return NULL;
+    if (bank == BLOCK_WRAM) {
+        limit = (pc | (PAGE_SIZE - 1)) + 1; // a block never spans two pages
+        if (!(mmu->code_pages & (1u << ((pc & 0x1fff) >> PAGE_SHIFT))))
+            mmu_watch_code(mmu, pc);
+    }
+
+    b->pc = pc;
+    b->bank = bank;
+    b->gen = gen;
+    b->len = 0;
+#ifdef SM83_JIT
+    b->heat = 0;
+    b->native = NULL;
+#endif
+    uint32_t addr = pc;
+    do {
+        uint8_t op = mmu_read8(mmu, addr), size = block_op_size(op);
+        if (addr + size > limit) // the operand is past the end of the bank or page
+            break;
+        block_op *bop = &b->ops[b->len++];
+        *bop = (block_op){.op = op};
+        if (size == 2)
+            bop->imm = mmu_read8(mmu, addr + 1);
+        else if (size == 3)
+            bop->imm = mmu_read16(mmu, addr + 1);
+        addr += size;
+        if (block_op_ends(op))
+            break;
+    } while (b->len < BLOCK_OPS && addr < limit);
+    return b->len ? b : NULL;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmu.h"
+
+// straight line runs of instructions decoded once and kept, so the cpu can run
+// them without fetching every byte through the page tables
+#define BLOCK_OPS 32 // longest block, anything longer is split
+#define BLOCK_SLOTS 2048 // direct mapped, a power of 2
+#define BLOCK_WRAM 0xffff // the bank of blocks decoded from wram
+
+typedef struct {
+#ifdef SM83_COMPUTED_GOTO
+    const void *handler; // filled in by the cpu the first time the block runs
+#endif
+    uint16_t imm; // the operand, or the second byte of a cb instruction
+    uint8_t op;
+} block_op;
+
+typedef struct {
+    uint16_t pc, bank; // rom bank the code came from, or BLOCK_WRAM
+    uint32_t gen; // code_gen of the wram page when it was decoded
+    uint8_t len; // 0 for an empty slot
+#ifdef SM83_JIT
+    uint8_t heat; // runs so far, stops at JIT_HOT
+    uint32_t native_cycles; // m-cycles before its last op, it only runs if none of them can hit an event
+    const uint8_t *native; // compiled code, see jit.h
+#endif
+    block_op ops[BLOCK_OPS];
+} block;
+
+typedef struct {
+    block slots[BLOCK_SLOTS];
+} block_cache;
+
+// returns NULL if it can't be allocated
+block_cache *block_cache_new(void);
+void block_cache_free(block_cache *self);
+// bytes taken by an instruction and its operands
+uint8_t block_op_size(uint8_t op);
+// decodes the block starting at 'pc' into 'b', NULL for code that can't be cached
+// (the bootrom, vram, cart ram and hram) which has to be interpreted
+block *block_decode(block *b, _mmu *mmu, uint16_t pc, uint16_t bank, uint32_t gen);
+
+// the block starting at 'pc', decoded again if it isn't cached or is stale
+static inline block *block_find(block_cache *self, _mmu *mmu, uint16_t pc) {
+    // rom blocks are told apart by bank, wram ones by the generation of their page
+    uint16_t bank;
+    uint32_t gen = 0;
+    if (pc < 0x8000) {
+        bank = pc < 0x4000 ? mmu->mbc.rom0 : mmu->mbc.romx;
+    } else if (pc >= 0xc000 && pc < 0xfe00) {
+        bank = BLOCK_WRAM;
+        gen = mmu->code_gen[(pc & 0x1fff) >> PAGE_SHIFT];
+    } else {
+        return NULL;
+    }
+    block *b = &self->slots[(pc ^ (bank << 6)) & (BLOCK_SLOTS - 1)];
+    if (b->len && b->pc == pc && b->bank == bank && b->gen == gen)
+        return b;
+    return block_decode(b, mmu, pc, bank, gen);
+}
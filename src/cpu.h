@@ -1,7 +1,18 @@
+#pragma once
+
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "block.h"
+#ifdef SM83_JIT
+#include "jit.h"
+#endif
 #include "mmu.h"
+#include "profile.h"
+#include "trace.h"
+
+// m-cycles in one 154 line frame, a bit under 60Hz
+#define FRAME_CYCLES 17556
 
 // endianness
 #define HI 1
@@ -20,13 +31,59 @@ typedef union _reg {
     } flags;
 } reg;
 
+// the flags of the last 8 bit alu op are kept as its operands and result and only worked
+// out when something reads them, most get overwritten by the next one before that.
+// it never leaves the instruction loops, af always holds the flags outside them
+enum { LAZY_NONE, LAZY_ADD, LAZY_SUB, LAZY_AND, LAZY_OR }; // xor has the same flags as or
+
+typedef struct {
+    uint8_t op;
+    uint8_t a, b;
+    uint16_t res; // bit 8 is the carry, or the borrow of a sub
+} lazy_flags;
+
 typedef struct {
     bool halt, ime;
+    bool ei; // ime turns on after the instruction following ei
+    // every memory access gets its own m-cycle and sees events due before it, slower
+    // but right for roms that time i/o within an instruction. overrides blocks and the jit
+    bool accurate;
     uint16_t pc, sp;
     reg af, bc, de, hl;
+    lazy_flags lazy;
+    uint64_t insts; // instructions executed since power on
     _mmu *mmu;
+    trace *trace; // every instruction is recorded here when set
+    block_cache *blocks; // runs from decoded blocks when set, see sm83_use_blocks
+#ifdef SM83_JIT
+    jit *jit; // compiles the hot ones when set, see sm83_use_jit
+#endif
+#ifdef SM83_PROFILE
+    profile *prof;
+#endif
 } sm83;
 
-void sm83_init(sm83 *self, uint8_t *bootrom, uint8_t *rom);
+void sm83_init(sm83 *self, const uint8_t *bootrom, const uint8_t *rom);
 void sm83_deinit(sm83 *self);
+// starts 'self' off as a copy of 'parent' that shares its ram until either writes to it, see
+// mmu_fork. the child runs on the plain interpreter without a trace until told otherwise,
+// and has to be deinitialised on its own
+void sm83_fork(sm83 *self, sm83 *parent);
+// switches between the plain interpreter and running from a cache of decoded blocks,
+// which gives the same results, returns false if the cache can't be allocated
+bool sm83_use_blocks(sm83 *self, bool on);
+#ifdef SM83_JIT
+// compiles hot rom blocks to x86-64, turning the block cache on as well. with 'check' each
+// compiled block is also run through the interpreter and turned off if the two disagree,
+// returns false if the cache or the executable memory can't be allocated
+bool sm83_use_jit(sm83 *self, bool on, bool check);
+#endif
 uint8_t sm83_step(sm83 *self); // returns number of M-cycles for the executed instruction
+// runs until the budget is spent, handling events and interrupts as they come due and skipping
+// straight to the next event while halted, returns M-cycles executed
+uint64_t sm83_run(sm83 *self, uint64_t cycle_budget);
+
+// halted with no interrupts enabled, nothing will ever wake it up again
+static inline bool sm83_locked_up(const sm83 *self) {
+    return self->halt && !(self->mmu->hram[0x7f] & 0x1f);
+}
@@ -0,0 +1,633 @@
+// every instruction, included inside each instruction loop in cpu.c. the loop sets inst to
+// the opcode with pc already past it, FETCH8/FETCH16 take the operands and advance pc
+DISPATCH(inst) {
+    OP(0x00): // nop
+        NEXT(1);
+
+    OP(0x10): // stop
+        NEXT(1);
+
+    // ime
+    OP(0xf3):
+        self->ime = false;
+        self->ei = false;
+        NEXT(1);
+    OP(0xfb): self->ei = true; NEXT(1); // drops out of the loop to handle the delay
+
+    // jr
+    OP(0x18):
+        tmp = FETCH8();
+        self->pc += (int8_t)tmp;
+        NEXT(3);
+    OP(0x20): NEXT(jrcond(self, !flag_z(self), FETCH8()));
+    OP(0x30): NEXT(jrcond(self, !flag_c(self), FETCH8()));
+    OP(0x28): NEXT(jrcond(self, flag_z(self), FETCH8()));
+    OP(0x38): NEXT(jrcond(self, flag_c(self), FETCH8()));
+
+    // jp instructions
+    OP(0xc3): // jp a16
+        self->pc = FETCH16();
+        NEXT(4);
+    OP(0xe9): self->pc = self->hl.pair; NEXT(1);
+    OP(0xc2): NEXT(jpcond(self, !flag_z(self), FETCH16()));
+    OP(0xd2): NEXT(jpcond(self, !flag_c(self), FETCH16()));
+    OP(0xca): NEXT(jpcond(self, flag_z(self), FETCH16()));
+    OP(0xda): NEXT(jpcond(self, flag_c(self), FETCH16()));
+
+    // ret instructions
+    OP(0xc0): NEXT(retcond(self, !flag_z(self), TIMED));
+    OP(0xd0): NEXT(retcond(self, !flag_c(self), TIMED));
+    OP(0xc8): NEXT(retcond(self, flag_z(self), TIMED));
+    OP(0xd8): NEXT(retcond(self, flag_c(self), TIMED));
+    OP(0xc9): pop16(self, &self->pc, TIMED); NEXT(4);
+    OP(0xd9): // reti
+        pop16(self, &self->pc, TIMED);
+        self->ime = true;
+        sched_kick(&mmu->sched); // something may be pending already
+        NEXT(4);
+
+    // rst instructions
+    OP(0xc7): NEXT(rst(self, 0x00, TIMED));
+    OP(0xd7): NEXT(rst(self, 0x10, TIMED));
+    OP(0xe7): NEXT(rst(self, 0x20, TIMED));
+    OP(0xf7): NEXT(rst(self, 0x30, TIMED));
+    OP(0xcf): NEXT(rst(self, 0x08, TIMED));
+    OP(0xdf): NEXT(rst(self, 0x18, TIMED));
+    OP(0xef): NEXT(rst(self, 0x28, TIMED));
+    OP(0xff): NEXT(rst(self, 0x38, TIMED));
+
+    // call instructions
+    OP(0xc4): NEXT(callcond(self, !flag_z(self), FETCH16(), TIMED));
+    OP(0xd4): NEXT(callcond(self, !flag_c(self), FETCH16(), TIMED));
+    OP(0xcc): NEXT(callcond(self, flag_z(self), FETCH16(), TIMED));
+    OP(0xdc): NEXT(callcond(self, flag_c(self), FETCH16(), TIMED));
+    OP(0xcd): call(self, FETCH16(), TIMED); NEXT(6);
+
+    // stack instructions, F's low 4 bits are ALWAYS ignored
+    OP(0xc1): pop16(self, &self->bc.pair, TIMED); NEXT(3);
+    OP(0xd1): pop16(self, &self->de.pair, TIMED); NEXT(3);
+    OP(0xe1): pop16(self, &self->hl.pair, TIMED); NEXT(3);
+    OP(0xf1):
+        pop16(self, &self->af.pair, TIMED);
+        self->af.flags.lo = 0;
+        self->lazy.op = LAZY_NONE; // all of f is overwritten
+        NEXT(3);
+    OP(0xc5): push16(self, self->bc.pair, TIMED); NEXT(4);
+    OP(0xd5): push16(self, self->de.pair, TIMED); NEXT(4);
+    OP(0xe5): push16(self, self->hl.pair, TIMED); NEXT(4);
+    OP(0xf5):
+        sm83_flags(self);
+        push16(self, self->af.pair & 0xfff0, TIMED);
+        NEXT(4);
+
+    // rotate instructions
+    OP(0x07): // rlca
+        self->lazy.op = LAZY_NONE; // all of f is overwritten
+        self->af.flags.h = 0;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        self->af.flags.c = self->af.hilo[HI] >> 7;
+        self->af.hilo[HI] = (self->af.hilo[HI] << 1) | self->af.flags.c;
+        NEXT(1);
+    OP(0x17): // rla
+        self->af.flags.h = 0;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        tmp = flag_c(self);
+        self->lazy.op = LAZY_NONE;
+        self->af.flags.c = self->af.hilo[HI] >> 7;
+        self->af.hilo[HI] = (self->af.hilo[HI] << 1) | tmp;
+        NEXT(1);
+    OP(0x0f): // rrca
+        self->lazy.op = LAZY_NONE; // all of f is overwritten
+        self->af.flags.h = 0;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        self->af.flags.c = self->af.hilo[HI] & 1;
+        self->af.hilo[HI] = (self->af.hilo[HI] >> 1) | (self->af.flags.c << 7);
+        NEXT(1);
+    OP(0x1f): // rra
+        self->af.flags.h = 0;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        tmp = flag_c(self);
+        self->lazy.op = LAZY_NONE;
+        self->af.flags.c = self->af.hilo[HI] & 1;
+        self->af.hilo[HI] = (self->af.hilo[HI] >> 1) | (tmp << 7);
+        NEXT(1);
+
+    // flag instructions
+    OP(0x37): // scf
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = 0;
+        self->af.flags.c = 1;
+        NEXT(1);
+    OP(0x2f): // cpl
+        sm83_flags(self);
+        self->af.hilo[HI] = ~self->af.hilo[HI];
+        self->af.flags.n = 1;
+        self->af.flags.h = 1;
+        NEXT(1);
+    OP(0x3f): // ccf
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = 0;
+        self->af.flags.c = !self->af.flags.c;
+        NEXT(1);
+
+    // daa (the final boss of instructions)
+    OP(0x27):
+        sm83_flags(self);
+        if (!self->af.flags.n) {
+            if (self->af.flags.c || self->af.hilo[HI] > 0x99) {
+                self->af.hilo[HI] += 0x60;
+                self->af.flags.c = 1;
+            }
+            if (self->af.flags.h || (self->af.hilo[HI] & 0x0f) > 0x09) {
+                self->af.hilo[HI] += 0x6;
+            }
+        } else {
+            if (self->af.flags.c)
+                self->af.hilo[HI] -= 0x60;
+            if (self->af.flags.h)
+                self->af.hilo[HI] -= 0x6;
+        }
+        self->af.flags.z = self->af.hilo[HI] == 0;
+        self->af.flags.h = 0;
+        NEXT(1);
+
+    // ld xx, n16
+    OP(0x01):
+        self->bc.pair = FETCH16();
+        NEXT(3);
+    OP(0x11):
+        self->de.pair = FETCH16();
+        NEXT(3);
+    OP(0x21):
+        self->hl.pair = FETCH16();
+        NEXT(3);
+    OP(0x31):
+        self->sp = FETCH16();
+        NEXT(3);
+
+    // ld [xx], a
+    OP(0x02): WRITE8(self->bc.pair, self->af.hilo[HI]); NEXT(2);
+    OP(0x12): WRITE8(self->de.pair, self->af.hilo[HI]); NEXT(2);
+    OP(0x22): WRITE8(self->hl.pair++, self->af.hilo[HI]); NEXT(2);
+    OP(0x32): WRITE8(self->hl.pair--, self->af.hilo[HI]); NEXT(2);
+
+    // inc xx
+    OP(0x03): ++self->bc.pair; NEXT(2);
+    OP(0x13): ++self->de.pair; NEXT(2);
+    OP(0x23): ++self->hl.pair; NEXT(2);
+    OP(0x33): ++self->sp; NEXT(2);
+
+    // inc x
+    OP(0x04):
+        ++self->bc.hilo[HI];
+        incdec_flags(self, self->bc.hilo[HI], false);
+        NEXT(1);
+    OP(0x14):
+        ++self->de.hilo[HI];
+        incdec_flags(self, self->de.hilo[HI], false);
+        NEXT(1);
+    OP(0x24):
+        ++self->hl.hilo[HI];
+        incdec_flags(self, self->hl.hilo[HI], false);
+        NEXT(1);
+    OP(0x34):
+        tmp = READ8(self->hl.pair) + 1;
+        WRITE8(self->hl.pair, tmp);
+        incdec_flags(self, tmp, false);
+        NEXT(3);
+
+    // dec x
+    OP(0x05):
+        --self->bc.hilo[HI];
+        incdec_flags(self, self->bc.hilo[HI], true);
+        NEXT(1);
+    OP(0x15):
+        --self->de.hilo[HI];
+        incdec_flags(self, self->de.hilo[HI], true);
+        NEXT(1);
+    OP(0x25):
+        --self->hl.hilo[HI];
+        incdec_flags(self, self->hl.hilo[HI], true);
+        NEXT(1);
+    OP(0x35):
+        WRITE8(self->hl.pair, tmp = READ8(self->hl.pair) - 1);
+        incdec_flags(self, tmp, true);
+        NEXT(3);
+
+    // ld x, n8
+    OP(0x06): self->bc.hilo[HI] = FETCH8(); NEXT(2);
+    OP(0x16): self->de.hilo[HI] = FETCH8(); NEXT(2);
+    OP(0x26): self->hl.hilo[HI] = FETCH8(); NEXT(2);
+    OP(0x36): WRITE8(self->hl.pair, FETCH8()); NEXT(3);
+
+    // add hl, xx
+    OP(0x09):
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = (((self->hl.pair & 0xfff) + (self->bc.pair & 0xfff)) >> 12) & 1;
+        self->af.flags.c = ((self->hl.pair + self->bc.pair) >> 16) & 1;
+        self->hl.pair += self->bc.pair;
+        NEXT(2);
+    OP(0x19):
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = (((self->hl.pair & 0xfff) + (self->de.pair & 0xfff)) >> 12) & 1;
+        self->af.flags.c = ((self->hl.pair + self->de.pair) >> 16) & 1;
+        self->hl.pair += self->de.pair;
+        NEXT(2);
+    OP(0x29):
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = (((self->hl.pair & 0xfff) + (self->hl.pair & 0xfff)) >> 12) & 1;
+        self->af.flags.c = ((self->hl.pair + self->hl.pair) >> 16) & 1;
+        self->hl.pair += self->hl.pair;
+        NEXT(2);
+    OP(0x39):
+        sm83_flags(self);
+        self->af.flags.n = 0;
+        self->af.flags.h = (((self->hl.pair & 0xfff) + (self->sp & 0xfff)) >> 12) & 1;
+        self->af.flags.c = ((self->hl.pair + self->sp) >> 16) & 1;
+        self->hl.pair += self->sp;
+        NEXT(2);
+
+    // ld a, [xx]
+    OP(0x0a): self->af.hilo[HI] = READ8(self->bc.pair); NEXT(2);
+    OP(0x1a): self->af.hilo[HI] = READ8(self->de.pair); NEXT(2);
+    OP(0x2a): self->af.hilo[HI] = READ8(self->hl.pair++); NEXT(2);
+    OP(0x3a): self->af.hilo[HI] = READ8(self->hl.pair--); NEXT(2);
+
+    // dec xx
+    OP(0x0b): --self->bc.pair; NEXT(2);
+    OP(0x1b): --self->de.pair; NEXT(2);
+    OP(0x2b): --self->hl.pair; NEXT(2);
+    OP(0x3b): --self->sp; NEXT(2);
+
+    // inc x
+    OP(0x0c):
+        ++self->bc.hilo[LO];
+        incdec_flags(self, self->bc.hilo[LO], false);
+        NEXT(1);
+    OP(0x1c):
+        ++self->de.hilo[LO];
+        incdec_flags(self, self->de.hilo[LO], false);
+        NEXT(1);
+    OP(0x2c):
+        ++self->hl.hilo[LO];
+        incdec_flags(self, self->hl.hilo[LO], false);
+        NEXT(1);
+    OP(0x3c):
+        ++self->af.hilo[HI];
+        incdec_flags(self, self->af.hilo[HI], false);
+        NEXT(1);
+
+    // dec x
+    OP(0x0d):
+        --self->bc.hilo[LO];
+        incdec_flags(self, self->bc.hilo[LO], true);
+        NEXT(1);
+    OP(0x1d):
+        --self->de.hilo[LO];
+        incdec_flags(self, self->de.hilo[LO], true);
+        NEXT(1);
+    OP(0x2d):
+        --self->hl.hilo[LO];
+        incdec_flags(self, self->hl.hilo[LO], true);
+        NEXT(1);
+    OP(0x3d):
+        --self->af.hilo[HI];
+        incdec_flags(self, self->af.hilo[HI], true);
+        NEXT(1);
+
+    // ld x, n8
+    OP(0x0e): self->bc.hilo[LO] = FETCH8(); NEXT(2);
+    OP(0x1e): self->de.hilo[LO] = FETCH8(); NEXT(2);
+    OP(0x2e): self->hl.hilo[LO] = FETCH8(); NEXT(2);
+    OP(0x3e): self->af.hilo[HI] = FETCH8(); NEXT(2);
+
+    // ld x, x
+    OP(0x40): self->bc.hilo[HI] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x41): self->bc.hilo[HI] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x42): self->bc.hilo[HI] = self->de.hilo[HI]; NEXT(1);
+    OP(0x43): self->bc.hilo[HI] = self->de.hilo[LO]; NEXT(1);
+    OP(0x44): self->bc.hilo[HI] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x45): self->bc.hilo[HI] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x46): self->bc.hilo[HI] = READ8(self->hl.pair); NEXT(2);
+    OP(0x47): self->bc.hilo[HI] = self->af.hilo[HI]; NEXT(1);
+    OP(0x48): self->bc.hilo[LO] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x49): self->bc.hilo[LO] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x4a): self->bc.hilo[LO] = self->de.hilo[HI]; NEXT(1);
+    OP(0x4b): self->bc.hilo[LO] = self->de.hilo[LO]; NEXT(1);
+    OP(0x4c): self->bc.hilo[LO] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x4d): self->bc.hilo[LO] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x4e): self->bc.hilo[LO] = READ8(self->hl.pair); NEXT(2);
+    OP(0x4f): self->bc.hilo[LO] = self->af.hilo[HI]; NEXT(1);
+    OP(0x50): self->de.hilo[HI] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x51): self->de.hilo[HI] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x52): self->de.hilo[HI] = self->de.hilo[HI]; NEXT(1);
+    OP(0x53): self->de.hilo[HI] = self->de.hilo[LO]; NEXT(1);
+    OP(0x54): self->de.hilo[HI] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x55): self->de.hilo[HI] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x56): self->de.hilo[HI] = READ8(self->hl.pair); NEXT(2);
+    OP(0x57): self->de.hilo[HI] = self->af.hilo[HI]; NEXT(1);
+    OP(0x58): self->de.hilo[LO] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x59): self->de.hilo[LO] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x5a): self->de.hilo[LO] = self->de.hilo[HI]; NEXT(1);
+    OP(0x5b): self->de.hilo[LO] = self->de.hilo[LO]; NEXT(1);
+    OP(0x5c): self->de.hilo[LO] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x5d): self->de.hilo[LO] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x5e): self->de.hilo[LO] = READ8(self->hl.pair); NEXT(2);
+    OP(0x5f): self->de.hilo[LO] = self->af.hilo[HI]; NEXT(1);
+    OP(0x60): self->hl.hilo[HI] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x61): self->hl.hilo[HI] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x62): self->hl.hilo[HI] = self->de.hilo[HI]; NEXT(1);
+    OP(0x63): self->hl.hilo[HI] = self->de.hilo[LO]; NEXT(1);
+    OP(0x64): self->hl.hilo[HI] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x65): self->hl.hilo[HI] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x66): self->hl.hilo[HI] = READ8(self->hl.pair); NEXT(2);
+    OP(0x67): self->hl.hilo[HI] = self->af.hilo[HI]; NEXT(1);
+    OP(0x68): self->hl.hilo[LO] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x69): self->hl.hilo[LO] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x6a): self->hl.hilo[LO] = self->de.hilo[HI]; NEXT(1);
+    OP(0x6b): self->hl.hilo[LO] = self->de.hilo[LO]; NEXT(1);
+    OP(0x6c): self->hl.hilo[LO] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x6d): self->hl.hilo[LO] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x6e): self->hl.hilo[LO] = READ8(self->hl.pair); NEXT(2);
+    OP(0x6f): self->hl.hilo[LO] = self->af.hilo[HI]; NEXT(1);
+    OP(0x70): WRITE8(self->hl.pair, self->bc.hilo[HI]); NEXT(2);
+    OP(0x71): WRITE8(self->hl.pair, self->bc.hilo[LO]); NEXT(2);
+    OP(0x72): WRITE8(self->hl.pair, self->de.hilo[HI]); NEXT(2);
+    OP(0x73): WRITE8(self->hl.pair, self->de.hilo[LO]); NEXT(2);
+    OP(0x74): WRITE8(self->hl.pair, self->hl.hilo[HI]); NEXT(2);
+    OP(0x75): WRITE8(self->hl.pair, self->hl.hilo[LO]); NEXT(2);
+    OP(0x76): self->halt = true; NEXT(1);
+    OP(0x77): WRITE8(self->hl.pair, self->af.hilo[HI]); NEXT(2);
+    OP(0x78): self->af.hilo[HI] = self->bc.hilo[HI]; NEXT(1);
+    OP(0x79): self->af.hilo[HI] = self->bc.hilo[LO]; NEXT(1);
+    OP(0x7a): self->af.hilo[HI] = self->de.hilo[HI]; NEXT(1);
+    OP(0x7b): self->af.hilo[HI] = self->de.hilo[LO]; NEXT(1);
+    OP(0x7c): self->af.hilo[HI] = self->hl.hilo[HI]; NEXT(1);
+    OP(0x7d): self->af.hilo[HI] = self->hl.hilo[LO]; NEXT(1);
+    OP(0x7e): self->af.hilo[HI] = READ8(self->hl.pair); NEXT(2);
+    OP(0x7f): self->af.hilo[HI] = self->af.hilo[HI]; NEXT(1);
+
+    // wierd ld instructions
+    OP(0xe0):
+        WRITE8(FETCH8() + 0xff00, self->af.hilo[HI]);
+        NEXT(3);
+    OP(0xf0):
+        self->af.hilo[HI] = READ8(FETCH8() + 0xff00);
+        NEXT(3);
+    OP(0xe2):
+        WRITE8(self->bc.hilo[LO] + 0xff00, self->af.hilo[HI]);
+        NEXT(2);
+    OP(0xf2):
+        self->af.hilo[HI] = READ8(self->bc.hilo[LO] + 0xff00);
+        NEXT(2);
+    OP(0xea):
+        WRITE8(FETCH16(), self->af.hilo[HI]);
+        NEXT(4);
+    OP(0xfa):
+        self->af.hilo[HI] = READ8(FETCH16());
+        NEXT(4);
+    OP(0xf8):
+        tmp = FETCH8();
+        self->lazy.op = LAZY_NONE;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        self->af.flags.h = (self->sp ^ (int8_t)tmp ^ (self->sp + (int8_t)tmp)) >> 4;
+        self->af.flags.c = (self->sp ^ (int8_t)tmp ^ (self->sp + (int8_t)tmp)) >> 8;
+        self->hl.pair = self->sp + (int8_t)tmp;
+        NEXT(3);
+    OP(0xf9):
+        self->sp = self->hl.pair;
+        NEXT(2);
+    OP(0x08):
+        bus_write16(self, FETCH16(), self->sp, TIMED);
+        NEXT(5);
+
+    // logical instructions
+    // this wierd add sp, e8 thing
+    OP(0xe8):
+        tmp = FETCH8();
+        self->lazy.op = LAZY_NONE;
+        self->af.flags.n = 0;
+        self->af.flags.z = 0;
+        self->af.flags.h = (self->sp ^ (int8_t)tmp ^ (self->sp + (int8_t)tmp)) >> 4;
+        self->af.flags.c = (self->sp ^ (int8_t)tmp ^ (self->sp + (int8_t)tmp)) >> 8;
+        self->sp += (int8_t)tmp;
+        NEXT(4);
+    // add
+    OP(0x80): self->af.hilo[HI] = add8(self, self->bc.hilo[HI], 0); NEXT(1);
+    OP(0x81): self->af.hilo[HI] = add8(self, self->bc.hilo[LO], 0); NEXT(1);
+    OP(0x82): self->af.hilo[HI] = add8(self, self->de.hilo[HI], 0); NEXT(1);
+    OP(0x83): self->af.hilo[HI] = add8(self, self->de.hilo[LO], 0); NEXT(1);
+    OP(0x84): self->af.hilo[HI] = add8(self, self->hl.hilo[HI], 0); NEXT(1);
+    OP(0x85): self->af.hilo[HI] = add8(self, self->hl.hilo[LO], 0); NEXT(1);
+    OP(0x86): self->af.hilo[HI] = add8(self, READ8(self->hl.pair), 0); NEXT(2);
+    OP(0x87): self->af.hilo[HI] = add8(self, self->af.hilo[HI], 0); NEXT(1);
+    // adc
+    OP(0x88): self->af.hilo[HI] = add8(self, self->bc.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x89): self->af.hilo[HI] = add8(self, self->bc.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x8a): self->af.hilo[HI] = add8(self, self->de.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x8b): self->af.hilo[HI] = add8(self, self->de.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x8c): self->af.hilo[HI] = add8(self, self->hl.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x8d): self->af.hilo[HI] = add8(self, self->hl.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x8e): self->af.hilo[HI] = add8(self, READ8(self->hl.pair), flag_c(self)); NEXT(2);
+    OP(0x8f): self->af.hilo[HI] = add8(self, self->af.hilo[HI], flag_c(self)); NEXT(1);
+    // sub
+    OP(0x90): self->af.hilo[HI] = sub8(self, self->bc.hilo[HI], 0); NEXT(1);
+    OP(0x91): self->af.hilo[HI] = sub8(self, self->bc.hilo[LO], 0); NEXT(1);
+    OP(0x92): self->af.hilo[HI] = sub8(self, self->de.hilo[HI], 0); NEXT(1);
+    OP(0x93): self->af.hilo[HI] = sub8(self, self->de.hilo[LO], 0); NEXT(1);
+    OP(0x94): self->af.hilo[HI] = sub8(self, self->hl.hilo[HI], 0); NEXT(1);
+    OP(0x95): self->af.hilo[HI] = sub8(self, self->hl.hilo[LO], 0); NEXT(1);
+    OP(0x96): self->af.hilo[HI] = sub8(self, READ8(self->hl.pair), 0); NEXT(2);
+    OP(0x97): self->af.hilo[HI] = sub8(self, self->af.hilo[HI], 0); NEXT(1);
+    // sbc
+    OP(0x98): self->af.hilo[HI] = sub8(self, self->bc.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x99): self->af.hilo[HI] = sub8(self, self->bc.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x9a): self->af.hilo[HI] = sub8(self, self->de.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x9b): self->af.hilo[HI] = sub8(self, self->de.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x9c): self->af.hilo[HI] = sub8(self, self->hl.hilo[HI], flag_c(self)); NEXT(1);
+    OP(0x9d): self->af.hilo[HI] = sub8(self, self->hl.hilo[LO], flag_c(self)); NEXT(1);
+    OP(0x9e): self->af.hilo[HI] = sub8(self, READ8(self->hl.pair), flag_c(self)); NEXT(2);
+    OP(0x9f): self->af.hilo[HI] = sub8(self, self->af.hilo[HI], flag_c(self)); NEXT(1);
+    // and
+    OP(0xa0): self->af.hilo[HI] = and8(self, self->bc.hilo[HI]); NEXT(1);
+    OP(0xa1): self->af.hilo[HI] = and8(self, self->bc.hilo[LO]); NEXT(1);
+    OP(0xa2): self->af.hilo[HI] = and8(self, self->de.hilo[HI]); NEXT(1);
+    OP(0xa3): self->af.hilo[HI] = and8(self, self->de.hilo[LO]); NEXT(1);
+    OP(0xa4): self->af.hilo[HI] = and8(self, self->hl.hilo[HI]); NEXT(1);
+    OP(0xa5): self->af.hilo[HI] = and8(self, self->hl.hilo[LO]); NEXT(1);
+    OP(0xa6): self->af.hilo[HI] = and8(self, READ8(self->hl.pair)); NEXT(2);
+    OP(0xa7): self->af.hilo[HI] = and8(self, self->af.hilo[HI]); NEXT(1);
+    // xor
+    OP(0xa8): self->af.hilo[HI] = xor8(self, self->bc.hilo[HI]); NEXT(1);
+    OP(0xa9): self->af.hilo[HI] = xor8(self, self->bc.hilo[LO]); NEXT(1);
+    OP(0xaa): self->af.hilo[HI] = xor8(self, self->de.hilo[HI]); NEXT(1);
+    OP(0xab): self->af.hilo[HI] = xor8(self, self->de.hilo[LO]); NEXT(1);
+    OP(0xac): self->af.hilo[HI] = xor8(self, self->hl.hilo[HI]); NEXT(1);
+    OP(0xad): self->af.hilo[HI] = xor8(self, self->hl.hilo[LO]); NEXT(1);
+    OP(0xae): self->af.hilo[HI] = xor8(self, READ8(self->hl.pair)); NEXT(2);
+    OP(0xaf): self->af.hilo[HI] = xor8(self, self->af.hilo[HI]); NEXT(1);
+    // or
+    OP(0xb0): self->af.hilo[HI] = or8(self, self->bc.hilo[HI]); NEXT(1);
+    OP(0xb1): self->af.hilo[HI] = or8(self, self->bc.hilo[LO]); NEXT(1);
+    OP(0xb2): self->af.hilo[HI] = or8(self, self->de.hilo[HI]); NEXT(1);
+    OP(0xb3): self->af.hilo[HI] = or8(self, self->de.hilo[LO]); NEXT(1);
+    OP(0xb4): self->af.hilo[HI] = or8(self, self->hl.hilo[HI]); NEXT(1);
+    OP(0xb5): self->af.hilo[HI] = or8(self, self->hl.hilo[LO]); NEXT(1);
+    OP(0xb6): self->af.hilo[HI] = or8(self, READ8(self->hl.pair)); NEXT(2);
+    OP(0xb7): self->af.hilo[HI] = or8(self, self->af.hilo[HI]); NEXT(1);
+    // cp
+    OP(0xb8): sub8(self, self->bc.hilo[HI], 0); NEXT(1);
+    OP(0xb9): sub8(self, self->bc.hilo[LO], 0); NEXT(1);
+    OP(0xba): sub8(self, self->de.hilo[HI], 0); NEXT(1);
+    OP(0xbb): sub8(self, self->de.hilo[LO], 0); NEXT(1);
+    OP(0xbc): sub8(self, self->hl.hilo[HI], 0); NEXT(1);
+    OP(0xbd): sub8(self, self->hl.hilo[LO], 0); NEXT(1);
+    OP(0xbe): sub8(self, READ8(self->hl.pair), 0); NEXT(2);
+    OP(0xbf): sub8(self, self->af.hilo[HI], 0); NEXT(1);
+
+    // logic n8 instructions
+    OP(0xc6): self->af.hilo[HI] = add8(self, FETCH8(), 0); NEXT(2);
+    OP(0xce): self->af.hilo[HI] = add8(self, FETCH8(), flag_c(self)); NEXT(2);
+    OP(0xd6): self->af.hilo[HI] = sub8(self, FETCH8(), 0); NEXT(2);
+    OP(0xde): self->af.hilo[HI] = sub8(self, FETCH8(), flag_c(self)); NEXT(2);
+    OP(0xe6): self->af.hilo[HI] = and8(self, FETCH8()); NEXT(2);
+    OP(0xee): self->af.hilo[HI] = xor8(self, FETCH8()); NEXT(2);
+    OP(0xf6): self->af.hilo[HI] = or8(self, FETCH8()); NEXT(2);
+    OP(0xfe): sub8(self, FETCH8(), 0); NEXT(2);
+
+    //    0xcb instruction encodings
+    //    reg
+    //    000 b
+    //    001 c
+    //    010 d
+    //    011 e
+    //    100 h
+    //    101 l
+    //    110 [hl]
+    //    111 a
+    //
+    //    top 2 bits = 00
+    //    00000 reg rlc
+    //    00001 reg rrc
+    //    00010 reg rl
+    //    00011 reg rr
+    //    00100 reg sla
+    //    00101 reg sra
+    //    00110 reg swap
+    //    00111 reg srl
+    //
+    //    bitnum is a 3 bit literal
+    //    01 bitnum reg bit
+    //    10 bitnum reg res
+    //    11 bitnum reg set
+    OP(0xcb):
+        inst = FETCH8();
+        switch (inst & 7) {
+            case 0: val = self->bc.hilo[HI]; break;
+            case 1: val = self->bc.hilo[LO]; break;
+            case 2: val = self->de.hilo[HI]; break;
+            case 3: val = self->de.hilo[LO]; break;
+            case 4: val = self->hl.hilo[HI]; break;
+            case 5: val = self->hl.hilo[LO]; break;
+            case 6: val = READ8(self->hl.pair); break;
+            case 7: val = self->af.hilo[HI]; break;
+        }
+#ifdef SM83_COMPUTED_GOTO
+        goto *cb_table[inst];
+#else
+        switch (inst & 0xc0) {
+            case 0x40: goto cb_bit;
+            case 0x80: goto cb_res;
+            case 0xc0: goto cb_set;
+        }
+        switch (inst & 0x38) {
+            case 0x00: goto cb_rlc;
+            case 0x08: goto cb_rrc;
+            case 0x10: goto cb_rl;
+            case 0x18: goto cb_rr;
+            case 0x20: goto cb_sla;
+            case 0x28: goto cb_sra;
+            case 0x30: goto cb_swap;
+            default: goto cb_srl; // 0x38
+        }
+#endif
+    cb_bit:
+        sm83_flags(self); // keeps the carry
+        self->af.flags.z = !((val >> ((inst >> 3) & 0x7)) & 1);
+        self->af.flags.n = 0;
+        self->af.flags.h = 1;
+        NEXT((inst & 7) == 6 ? 3 : 2); // bit does not write back to the register
+    cb_res:
+        val &= (0xfe << ((inst >> 3) & 0x7)) | (0xff >> (8 - ((inst >> 3) & 0x7)));
+        goto cb_writeback;
+    cb_set:
+        val |= (0x1 << ((inst >> 3) & 0x7));
+        goto cb_writeback;
+    cb_rlc:
+        self->af.flags.c = val >> 7;
+        val = (val << 1) | self->af.flags.c;
+        goto cb_shiftflags;
+    cb_rrc:
+        self->af.flags.c = val & 1;
+        val = (val >> 1) | (self->af.flags.c << 7);
+        goto cb_shiftflags;
+    cb_rl:
+        tmp = flag_c(self);
+        self->af.flags.c = val >> 7;
+        val = (val << 1) | tmp;
+        goto cb_shiftflags;
+    cb_rr:
+        tmp = flag_c(self);
+        self->af.flags.c = val & 1;
+        val = (val >> 1) | (tmp << 7);
+        goto cb_shiftflags;
+    cb_sla:
+        self->af.flags.c = val >> 7;
+        val <<= 1;
+        goto cb_shiftflags;
+    cb_sra:
+        self->af.flags.c = val & 1;
+        val = (val >> 1) | (val & 0x80);
+        goto cb_shiftflags;
+    cb_swap:
+        self->af.flags.c = 0;
+        val = (val >> 4) | (val << 4);
+        goto cb_shiftflags;
+    cb_srl:
+        self->af.flags.c = val & 1;
+        val >>= 1;
+    cb_shiftflags:
+        self->lazy.op = LAZY_NONE; // all of f is overwritten
+        self->af.flags.n = 0;
+        self->af.flags.h = 0;
+        self->af.flags.z = val == 0;
+    cb_writeback:
+        // write back to register
+        switch (inst & 7) {
+            case 0: self->bc.hilo[HI] = val; break;
+            case 1: self->bc.hilo[LO] = val; break;
+            case 2: self->de.hilo[HI] = val; break;
+            case 3: self->de.hilo[LO] = val; break;
+            case 4: self->hl.hilo[HI] = val; break;
+            case 5: self->hl.hilo[LO] = val; break;
+            case 6: WRITE8(self->hl.pair, val); break;
+            case 7: self->af.hilo[HI] = val; break;
+        }
+        NEXT((inst & 7) == 6 ? 4 : 2); // (hl) is read and written back on m-cycles of their own
+
+    OP_DEFAULT:
+#ifdef DEBUG
+        fprintf(stderr, "warning: tried to execute unrecognised opcode \"0x%02x\"\n", mmu_read8(self->mmu, self->pc));
+#endif
+        NEXT(1);
+}
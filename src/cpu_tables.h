@@ -0,0 +1,45 @@
+// jump tables for -Ddispatch=goto, included at the top of each instruction loop in cpu.c
+// so the label addresses belong to that function
+static const void *const op_table[256] = {
+    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+    &&op_0x08, &&op_0x09, &&op_0x0a, &&op_0x0b, &&op_0x0c, &&op_0x0d, &&op_0x0e, &&op_0x0f,
+    &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+    &&op_0x18, &&op_0x19, &&op_0x1a, &&op_0x1b, &&op_0x1c, &&op_0x1d, &&op_0x1e, &&op_0x1f,
+    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+    &&op_0x28, &&op_0x29, &&op_0x2a, &&op_0x2b, &&op_0x2c, &&op_0x2d, &&op_0x2e, &&op_0x2f,
+    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+    &&op_0x38, &&op_0x39, &&op_0x3a, &&op_0x3b, &&op_0x3c, &&op_0x3d, &&op_0x3e, &&op_0x3f,
+    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+    &&op_0x48, &&op_0x49, &&op_0x4a, &&op_0x4b, &&op_0x4c, &&op_0x4d, &&op_0x4e, &&op_0x4f,
+    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+    &&op_0x58, &&op_0x59, &&op_0x5a, &&op_0x5b, &&op_0x5c, &&op_0x5d, &&op_0x5e, &&op_0x5f,
+    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+    &&op_0x68, &&op_0x69, &&op_0x6a, &&op_0x6b, &&op_0x6c, &&op_0x6d, &&op_0x6e, &&op_0x6f,
+    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+    &&op_0x78, &&op_0x79, &&op_0x7a, &&op_0x7b, &&op_0x7c, &&op_0x7d, &&op_0x7e, &&op_0x7f,
+    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+    &&op_0x88, &&op_0x89, &&op_0x8a, &&op_0x8b, &&op_0x8c, &&op_0x8d, &&op_0x8e, &&op_0x8f,
+    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+    &&op_0x98, &&op_0x99, &&op_0x9a, &&op_0x9b, &&op_0x9c, &&op_0x9d, &&op_0x9e, &&op_0x9f,
+    &&op_0xa0, &&op_0xa1, &&op_0xa2, &&op_0xa3, &&op_0xa4, &&op_0xa5, &&op_0xa6, &&op_0xa7,
+    &&op_0xa8, &&op_0xa9, &&op_0xaa, &&op_0xab, &&op_0xac, &&op_0xad, &&op_0xae, &&op_0xaf,
+    &&op_0xb0, &&op_0xb1, &&op_0xb2, &&op_0xb3, &&op_0xb4, &&op_0xb5, &&op_0xb6, &&op_0xb7,
+    &&op_0xb8, &&op_0xb9, &&op_0xba, &&op_0xbb, &&op_0xbc, &&op_0xbd, &&op_0xbe, &&op_0xbf,
+    &&op_0xc0, &&op_0xc1, &&op_0xc2, &&op_0xc3, &&op_0xc4, &&op_0xc5, &&op_0xc6, &&op_0xc7,
+    &&op_0xc8, &&op_0xc9, &&op_0xca, &&op_0xcb, &&op_0xcc, &&op_0xcd, &&op_0xce, &&op_0xcf,
+    &&op_0xd0, &&op_0xd1, &&op_0xd2, &&op_default, &&op_0xd4, &&op_0xd5, &&op_0xd6, &&op_0xd7,
+    &&op_0xd8, &&op_0xd9, &&op_0xda, &&op_default, &&op_0xdc, &&op_default, &&op_0xde, &&op_0xdf,
+    &&op_0xe0, &&op_0xe1, &&op_0xe2, &&op_default, &&op_default, &&op_0xe5, &&op_0xe6, &&op_0xe7,
+    &&op_0xe8, &&op_0xe9, &&op_0xea, &&op_default, &&op_default, &&op_default, &&op_0xee, &&op_0xef,
+    &&op_0xf0, &&op_0xf1, &&op_0xf2, &&op_0xf3, &&op_default, &&op_0xf5, &&op_0xf6, &&op_0xf7,
+    &&op_0xf8, &&op_0xf9, &&op_0xfa, &&op_0xfb, &&op_default, &&op_default, &&op_0xfe, &&op_0xff,
+};
+// bit/res/set only need the bit number from the opcode, so one label per row of 8
+#define CB_ROW(op) &&cb_##op, &&cb_##op, &&cb_##op, &&cb_##op, &&cb_##op, &&cb_##op, &&cb_##op, &&cb_##op
+static const void *const cb_table[256] = {
+    CB_ROW(rlc), CB_ROW(rrc), CB_ROW(rl), CB_ROW(rr), CB_ROW(sla), CB_ROW(sra), CB_ROW(swap), CB_ROW(srl),
+    CB_ROW(bit), CB_ROW(bit), CB_ROW(bit), CB_ROW(bit), CB_ROW(bit), CB_ROW(bit), CB_ROW(bit), CB_ROW(bit),
+    CB_ROW(res), CB_ROW(res), CB_ROW(res), CB_ROW(res), CB_ROW(res), CB_ROW(res), CB_ROW(res), CB_ROW(res),
+    CB_ROW(set), CB_ROW(set), CB_ROW(set), CB_ROW(set), CB_ROW(set), CB_ROW(set), CB_ROW(set), CB_ROW(set),
+};
+#undef CB_ROW
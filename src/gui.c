@@ -0,0 +1,344 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef SDL3_DEP
+#include <SDL3/SDL.h>
+#else
+#include <SDL.h>
+#endif
+
+#include "gui.h"
+
+#define CPU_HZ 1048576 // m-cycles per second, FRAME_CYCLES of them is a frame at 59.73 Hz
+#define NSEC 1000000000ll
+#define LAG_FRAMES 4 // further behind than this and the clock is reset instead of caught up
+#define FRESH 4 // set in 'mid' when it holds a frame the presenter hasn't seen
+#define AUDIO_QUEUED (APU_RATE / 10 * 4) // bytes of sound queued at most, more is dropped
+
+#ifdef SDL3_DEP
+typedef SDL_AudioStream *gui_audio;
+#else
+typedef SDL_AudioDeviceID gui_audio;
+#endif
+
+typedef uint8_t frame[SCREEN_H][SCREEN_W];
+
+// three frames owned by turns: the core draws into 'back', the presenter shows 'front'
+// and 'mid' is the last finished one. swapping indices never waits on the other side
+typedef struct {
+    frame bufs[3];
+    _Atomic uint8_t mid; // buffer index | FRESH
+    uint8_t back, front;
+} triple_buffer;
+
+typedef struct {
+    sm83 *cpu;
+    triple_buffer frames;
+    gui_audio audio; // 0 without sound
+    gui_options opts; // only touched by the emulation thread
+    _Atomic uint8_t buttons; // JOYPAD_* held on the keyboard
+    atomic_bool quit, turbo, rewinding;
+} gui;
+
+static const uint32_t shades[4] = {0xffe0f8d0, 0xff88c070, 0xff346856, 0xff081820};
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+// copies 'fb' into the back buffer, hands it over as the newest frame and takes whichever one that replaces
+static void frames_publish(triple_buffer *self, const frame fb) {
+    memcpy(self->bufs[self->back], fb, sizeof(self->bufs[0]));
+    self->back = atomic_exchange(&self->mid, self->back | FRESH) & 3;
+}
+
+// swaps in the newest frame, false if there's nothing new since the last one
+static bool frames_take(triple_buffer *self) {
+    if (!(atomic_load(&self->mid) & FRESH))
+        return false;
+    self->front = atomic_exchange(&self->mid, self->front) & 3;
+    return true;
+}
+
+// takes what the apu has made since the last frame and queues it, the device pulls it
+// on its own thread. nothing is queued while running uncapped or too far ahead
+static void gui_audio_push(gui *self, bool turbo) {
+    int16_t buf[2 * 1024];
+    size_t n;
+    while ((n = apu_samples(&self->cpu->mmu->apu, self->cpu->mmu->sched.now, buf, 1024))) {
+#ifdef SDL3_DEP
+        if (!turbo && SDL_GetAudioStreamQueued(self->audio) < AUDIO_QUEUED)
+            SDL_PutAudioStreamData(self->audio, buf, n * 4);
+#else
+        if (!turbo && SDL_GetQueuedAudioSize(self->audio) < AUDIO_QUEUED)
+            SDL_QueueAudio(self->audio, buf, n * 4);
+#endif
+    }
+}
+
+static gui_audio gui_audio_open(void) {
+#ifdef SDL3_DEP
+    SDL_AudioSpec spec = {SDL_AUDIO_S16, 2, APU_RATE};
+    if (!SDL_InitSubSystem(SDL_INIT_AUDIO))
+        return NULL;
+    SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, NULL, NULL);
+    if (stream)
+        SDL_ResumeAudioStreamDevice(stream);
+    return stream;
+#else
+    SDL_AudioSpec want = {.freq = APU_RATE, .format = AUDIO_S16SYS, .channels = 2, .samples = 512};
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO))
+        return 0;
+    SDL_AudioDeviceID dev = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (dev)
+        SDL_PauseAudioDevice(dev, 0);
+    return dev;
+#endif
+}
+
+static void gui_audio_close(gui_audio audio) {
+#ifdef SDL3_DEP
+    SDL_DestroyAudioStream(audio);
+#else
+    SDL_CloseAudioDevice(audio);
+#endif
+}
+
+// the emulation thread, runs a frame's worth of m-cycles at a time then sleeps until
+// the host clock catches up with the emulated one
+static void *gui_emulate(void *arg) {
+    gui *self = arg;
+    sm83 *cpu = self->cpu;
+    const ppu *lcd = &cpu->mmu->ppu;
+    const uint64_t *cycles = &cpu->mmu->sched.now;
+    uint64_t seen = lcd->frames, base_cycles = *cycles, movie_frame = 0;
+    int64_t base_ns = now_ns();
+    bool was_turbo = false;
+    while (!atomic_load_explicit(&self->quit, memory_order_relaxed)) {
+        if (self->opts.rewind && atomic_load_explicit(&self->rewinding, memory_order_relaxed)) {
+            // a state a frame, shown as it was taken, then the clock starts over from wherever it stops
+            if (rewind_pop(self->opts.rewind, cpu)) {
+                seen = lcd->frames;
+                frames_publish(&self->frames, lcd->fb);
+            }
+            struct timespec ts = {0, FRAME_CYCLES * NSEC / CPU_HZ};
+            nanosleep(&ts, NULL);
+            base_cycles = *cycles;
+            base_ns = now_ns();
+            continue;
+        }
+        // a linked one carries on answering the other end, which sets the pace
+        if (sm83_locked_up(cpu) && self->opts.link_fd == -1) {
+            if (!self->opts.rewind)
+                break;
+            // stays open so it can be rewound to before it locked up
+            struct timespec ts = {0, FRAME_CYCLES * NSEC / CPU_HZ};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        uint8_t buttons = atomic_load_explicit(&self->buttons, memory_order_relaxed);
+        if (self->opts.play && movie_frame < self->opts.play->frames)
+            buttons = self->opts.play->inputs[movie_frame];
+        if (self->opts.record && !movie_record(self->opts.record, buttons)) {
+            fprintf(stderr, "Unable to record any more input, stopping the recording\n");
+            self->opts.record = NULL;
+        }
+        mmu_set_buttons(cpu->mmu, buttons);
+        if (self->opts.link_fd == -1) {
+            sm83_run(cpu, FRAME_CYCLES);
+        } else if (!link_socket_run(self->opts.link_fd, cpu, FRAME_CYCLES)) {
+            fprintf(stderr, "The other end of the link cable went away\n");
+            self->opts.link_fd = -1;
+        }
+        ++movie_frame;
+        if (self->opts.rewind)
+            rewind_tick(self->opts.rewind, cpu);
+        if (lcd->frames != seen) { // nothing new while the lcd is off, the last frame stays up
+            seen = lcd->frames;
+            frames_publish(&self->frames, lcd->fb);
+        }
+
+        bool turbo = atomic_load_explicit(&self->turbo, memory_order_relaxed);
+        if (self->audio)
+            gui_audio_push(self, turbo);
+        int64_t now = now_ns();
+        if (turbo || was_turbo) { // coming out of turbo carries on from here rather than sleeping it off
+            was_turbo = turbo;
+            base_cycles = *cycles;
+            base_ns = now;
+            continue;
+        }
+        int64_t due = base_ns + (int64_t)((*cycles - base_cycles) * NSEC / CPU_HZ);
+        if (now - due > LAG_FRAMES * FRAME_CYCLES * NSEC / CPU_HZ) {
+            // the host stalled, running flat out to make up for it would look worse
+            base_cycles = *cycles;
+            base_ns = now;
+        } else if (due > now) {
+            struct timespec ts = {due / NSEC, due % NSEC};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) // interrupted, go back to sleep
+                ;
+        }
+    }
+    return NULL;
+}
+
+#ifdef SDL3_DEP
+#define KEY_SYM(ev) (ev).key.key
+#define EV_QUIT SDL_EVENT_QUIT
+#define EV_KEY_DOWN SDL_EVENT_KEY_DOWN
+#define EV_KEY_UP SDL_EVENT_KEY_UP
+#define KEY_X SDLK_X
+#define KEY_Z SDLK_Z
+#else
+#define KEY_SYM(ev) (ev).key.keysym.sym
+#define EV_QUIT SDL_QUIT
+#define EV_KEY_DOWN SDL_KEYDOWN
+#define EV_KEY_UP SDL_KEYUP
+#define KEY_X SDLK_x
+#define KEY_Z SDLK_z
+#endif
+
+static uint8_t gui_key_button(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_RIGHT: return JOYPAD_RIGHT;
+        case SDLK_LEFT: return JOYPAD_LEFT;
+        case SDLK_UP: return JOYPAD_UP;
+        case SDLK_DOWN: return JOYPAD_DOWN;
+        case KEY_X: return JOYPAD_A;
+        case KEY_Z: return JOYPAD_B;
+        case SDLK_RSHIFT: return JOYPAD_SELECT;
+        case SDLK_RETURN: return JOYPAD_START;
+        default: return 0;
+    }
+}
+
+// returns false once the window should close
+static bool gui_events(gui *self) {
+    SDL_Event ev;
+    while (SDL_PollEvent(&ev)) {
+        switch (ev.type) {
+            case EV_QUIT:
+                return false;
+            case EV_KEY_DOWN:
+            case EV_KEY_UP:
+                if (KEY_SYM(ev) == SDLK_TAB)
+                    atomic_store(&self->turbo, ev.type == EV_KEY_DOWN);
+                else if (KEY_SYM(ev) == SDLK_BACKSPACE)
+                    atomic_store(&self->rewinding, ev.type == EV_KEY_DOWN);
+                else if (KEY_SYM(ev) == SDLK_ESCAPE)
+                    return false;
+                else if (ev.type == EV_KEY_DOWN)
+                    atomic_fetch_or(&self->buttons, gui_key_button(KEY_SYM(ev)));
+                else
+                    atomic_fetch_and(&self->buttons, ~gui_key_button(KEY_SYM(ev)));
+                break;
+        }
+    }
+    return true;
+}
+
+static void gui_present(gui *self, SDL_Renderer *renderer, SDL_Texture *texture) {
+    void *pixels;
+    int pitch;
+#ifdef SDL3_DEP
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+#else
+    if (!SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+#endif
+        uint8_t(*fb)[SCREEN_W] = self->frames.bufs[self->frames.front];
+        for (int y = 0; y < SCREEN_H; ++y) {
+            uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+            for (int x = 0; x < SCREEN_W; ++x)
+                row[x] = shades[fb[y][x] & 3];
+        }
+        SDL_UnlockTexture(texture);
+    }
+    SDL_RenderClear(renderer);
+#ifdef SDL3_DEP
+    SDL_RenderTexture(renderer, texture, NULL, NULL);
+#else
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+#endif
+    SDL_RenderPresent(renderer); // waits for vsync, only this thread
+}
+
+bool gui_run(sm83 *cpu, const char *title, const gui_options *opts) {
+    int scale = opts->scale;
+#ifdef SDL3_DEP
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+#else
+    if (SDL_Init(SDL_INIT_VIDEO)) {
+#endif
+        fprintf(stderr, "Unable to start SDL: %s\n", SDL_GetError());
+        return false;
+    }
+#ifdef SDL3_DEP
+    SDL_Window *window = SDL_CreateWindow(title, SCREEN_W * scale, SCREEN_H * scale, SDL_WINDOW_RESIZABLE);
+    SDL_Renderer *renderer = window ? SDL_CreateRenderer(window, NULL) : NULL;
+    if (renderer)
+        SDL_SetRenderVSync(renderer, 1);
+#else
+    SDL_Window *window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_W * scale,
+        SCREEN_H * scale, SDL_WINDOW_RESIZABLE);
+    SDL_Renderer *renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC) : NULL;
+#endif
+    SDL_Texture *texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                          SDL_TEXTUREACCESS_STREAMING, SCREEN_W, SCREEN_H)
+                                    : NULL;
+    if (!texture) {
+        fprintf(stderr, "Unable to open a window: %s\n", SDL_GetError());
+        if (renderer)
+            SDL_DestroyRenderer(renderer);
+        if (window)
+            SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+#ifdef SDL3_DEP
+    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+    SDL_SetRenderLogicalPresentation(renderer, SCREEN_W, SCREEN_H, SDL_LOGICAL_PRESENTATION_INTEGER_SCALE);
+#else
+    SDL_RenderSetLogicalSize(renderer, SCREEN_W, SCREEN_H);
+#endif
+
+    // 'back' and 'front' start out owned by each side, 'mid' holds the third
+    gui self = {.cpu = cpu, .frames = {.mid = 2, .back = 0, .front = 1}, .opts = *opts, .buttons = 0, .quit = false,
+        .turbo = false, .rewinding = false};
+    // carries on silently without a sound device, the apu then isn't synthesized at all
+    if ((self.audio = gui_audio_open()) && !apu_use_output(&cpu->mmu->apu, &cpu->mmu->sched, true)) {
+        gui_audio_close(self.audio);
+        self.audio = 0;
+    }
+
+    pthread_t thread;
+    bool ok = !pthread_create(&thread, NULL, gui_emulate, &self);
+    if (!ok)
+        fprintf(stderr, "Unable to start the emulation thread\n");
+    while (ok && gui_events(&self)) {
+        if (frames_take(&self.frames))
+            gui_present(&self, renderer, texture);
+        else
+            SDL_Delay(1);
+    }
+    if (ok) {
+        atomic_store(&self.quit, true);
+        pthread_join(thread, NULL);
+    }
+    if (self.audio) {
+        gui_audio_close(self.audio);
+        apu_use_output(&cpu->mmu->apu, &cpu->mmu->sched, false);
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return ok;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "link.h"
+#include "movie.h"
+#include "rewind.h"
+
+#define GUI_SCALE 4 // window size in multiples of the screen
+#define GUI_REWIND_MB 8 // history kept for rewinding by default, minutes of it for most roms
+#define GUI_REWIND_FRAMES 2 // frames between the states taken, rewinding steps back one a frame
+
+// what the window runs with besides the cpu, rewinding can't be combined with the rest
+typedef struct {
+    int scale; // window size in multiples of the screen
+    rewind_ring *rewind; // holding backspace steps back through it, NULL for none
+    const movie *play; // overrides the pad until it runs out, NULL for none
+    movie *record; // gets every frame's buttons, NULL for none
+    int link_fd; // a link cable to another process (see link_socket_open) or -1
+} gui_options;
+
+// opens a window and runs 'cpu' in real time until it's closed. the emulation runs on its
+// own thread paced by the emulated clock, this thread only presents the frames it hands
+// over, so a slow present never holds the core back. holding tab runs it uncapped, the
+// arrows, x, z, enter and right shift are the pad. a linked instance in another process
+// keeps the two in step, whichever is slower sets the pace for both.
+// returns false if sdl or the emulation thread couldn't be started
+bool gui_run(sm83 *cpu, const char *title, const gui_options *opts);
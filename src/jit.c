@@ -0,0 +1,1027 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "jit.h"
+
+// host registers, the sm83 ones live in them for the whole block:
+// a = rbx, f = r10, b c d e = r12 r13 r14 r15, h l = r8 r9, sp = r11, the cpu is at rbp.
+// eax, ecx, edx, esi and edi are scratch, esi and edx also pass addresses and values to helpers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+#define REG_A RBX
+#define REG_F R10
+#define REG_SP R11
+// in the order the opcodes encode them, (hl) has no register
+static const int8_t gb_reg[8] = {R12, R13, R14, R15, R8, R9, -1, REG_A};
+
+// x86 condition codes
+enum { CC_B = 2, CC_E = 4, CC_NE = 5, CC_S = 8 };
+
+// sm83 flag bits
+#define FZ 0x80
+#define FN 0x40
+#define FH 0x20
+#define FC 0x10
+
+typedef struct {
+    uint8_t *p, *end;
+    bool full;
+    bool check;
+    const uint8_t *epilogue;
+    // side exits still to be written, the jumps to them are patched at the end
+    struct {
+        uint8_t *jump;
+        uint8_t op;
+    } exits[BLOCK_OPS * 2];
+    int exit_count;
+    uint16_t pc[BLOCK_OPS + 1]; // address of each op
+    uint32_t cycles[BLOCK_OPS + 1]; // m-cycles before each op
+} emitter;
+
+typedef struct {
+    uint8_t cycles; // m-cycles when not taken, for conditional control flow
+    uint8_t uses, defs; // flags read and written
+    bool exits; // may leave before it runs because the memory it touches isn't plain
+    bool ends; // control flow, always the last op of a block
+} op_info;
+
+// memory the compiled code may touch directly, anything else makes it leave the block
+static const uint8_t *jit_readable(_mmu *mmu, uint16_t addr) {
+    const uint8_t *page = mmu->rmap[addr >> PAGE_SHIFT];
+    if (page)
+        return page + (addr & (PAGE_SIZE - 1));
+    return addr >= 0xff80 ? &mmu->hram[addr - 0xff80] : NULL;
+}
+
+static uint8_t *jit_writable(_mmu *mmu, uint16_t addr) {
+    uint8_t *page = mmu->wmap[addr >> PAGE_SHIFT];
+    if (page)
+        return page + (addr & (PAGE_SIZE - 1));
+    // writing interrupt enable has to stop the cpu, so it isn't plain
+    return addr >= 0xff80 && addr != 0xffff ? &mmu->hram[addr - 0xff80] : NULL;
+}
+
+static void jit_store(jit *self, uint16_t addr, uint8_t *mem, uint8_t val) {
+    if (self->check && self->log_len < JIT_LOG)
+        self->log[self->log_len++] = (jit_write){addr, *mem, val};
+    *mem = val;
+}
+
+// called from compiled code, reads return -1 and writes 0 to leave the block
+static int jit_read8(sm83 *cpu, uint16_t addr) {
+    const uint8_t *mem = jit_readable(cpu->mmu, addr);
+    return mem ? *mem : -1;
+}
+
+static int jit_read16(sm83 *cpu, uint16_t addr) {
+    const uint8_t *lo = jit_readable(cpu->mmu, addr), *hi = jit_readable(cpu->mmu, addr + 1);
+    return lo && hi ? *lo | *hi << 8 : -1;
+}
+
+static int jit_write8(sm83 *cpu, uint16_t addr, uint8_t val) {
+    uint8_t *mem = jit_writable(cpu->mmu, addr);
+    if (!mem)
+        return 0;
+    jit_store(cpu->jit, addr, mem, val);
+    return 1;
+}
+
+// both bytes are checked first so a failed write leaves nothing behind
+static int jit_write16(sm83 *cpu, uint16_t addr, uint16_t val) {
+    uint8_t *lo = jit_writable(cpu->mmu, addr), *hi = jit_writable(cpu->mmu, addr + 1);
+    if (!lo || !hi)
+        return 0;
+    jit_store(cpu->jit, addr, lo, val & 0xff);
+    jit_store(cpu->jit, addr + 1, hi, val >> 8);
+    return 1;
+}
+
+static void e8(emitter *e, uint8_t v) {
+    if (e->p < e->end)
+        *e->p++ = v;
+    else
+        e->full = true;
+}
+
+static void e32(emitter *e, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        e8(e, v >> (i * 8));
+}
+
+static void e64(emitter *e, uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        e8(e, v >> (i * 8));
+}
+
+// 'byte' operands in spl/bpl/sil/dil need a rex prefix even when it carries no bits
+static void rex(emitter *e, bool w, int r, int m, bool byte) {
+    uint8_t v = 0x40 | (w ? 8 : 0) | (r & 8 ? 4 : 0) | (m & 8 ? 1 : 0);
+    if (v != 0x40 || (byte && ((r >= 4 && r < 8) || (m >= 4 && m < 8))))
+        e8(e, v);
+}
+
+static void modrm(emitter *e, int r, int m) {
+    e8(e, 0xc0 | (r & 7) << 3 | (m & 7));
+}
+
+// op r/m, r between registers, even opcodes are the 8 bit forms
+static void op_rr(emitter *e, uint8_t opc, int dst, int src) {
+    rex(e, false, src, dst, !(opc & 1));
+    e8(e, opc);
+    modrm(e, src, dst);
+}
+
+// op r/m, imm with the operation in the reg field
+static void op_ri(emitter *e, int digit, bool byte, int reg, uint32_t imm) {
+    rex(e, false, 0, reg, byte);
+    e8(e, byte ? 0x80 : 0x81);
+    modrm(e, digit, reg);
+    if (byte)
+        e8(e, imm);
+    else
+        e32(e, imm);
+}
+
+static void shift_ri(emitter *e, int digit, bool byte, int reg, uint8_t n) {
+    rex(e, false, 0, reg, byte);
+    e8(e, (n == 1 ? 0xd0 : 0xc0) | !byte);
+    modrm(e, digit, reg);
+    if (n != 1)
+        e8(e, n);
+}
+
+// inc and dec of a byte register
+static void incdec8(emitter *e, bool dec, int reg) {
+    rex(e, false, 0, reg, true);
+    e8(e, 0xfe);
+    modrm(e, dec, reg);
+}
+
+static void test_ri8(emitter *e, int reg, uint8_t imm) {
+    rex(e, false, 0, reg, true);
+    e8(e, 0xf6);
+    modrm(e, 0, reg);
+    e8(e, imm);
+}
+
+static void mov_ri(emitter *e, int reg, uint32_t imm) {
+    rex(e, false, 0, reg, false);
+    e8(e, 0xb8 + (reg & 7));
+    e32(e, imm);
+}
+
+static void movzx8(emitter *e, int dst, int src) {
+    rex(e, false, dst, src, true);
+    e8(e, 0x0f);
+    e8(e, 0xb6);
+    modrm(e, dst, src);
+}
+
+static void setcc(emitter *e, int cc, int reg) {
+    rex(e, false, 0, reg, true);
+    e8(e, 0x0f);
+    e8(e, 0x90 + cc);
+    modrm(e, 0, reg);
+}
+
+// movzx reg, byte/word [rbp + disp]
+static void load_cpu(emitter *e, bool word, int reg, int32_t disp) {
+    rex(e, false, reg, RBP, false);
+    e8(e, 0x0f);
+    e8(e, word ? 0xb7 : 0xb6);
+    e8(e, 0x80 | (reg & 7) << 3 | 5);
+    e32(e, disp);
+}
+
+// mov byte/word [rbp + disp], reg
+static void store_cpu(emitter *e, bool word, int reg, int32_t disp) {
+    if (word)
+        e8(e, 0x66);
+    rex(e, false, reg, RBP, !word);
+    e8(e, word ? 0x89 : 0x88);
+    e8(e, 0x80 | (reg & 7) << 3 | 5);
+    e32(e, disp);
+}
+
+static void push_r(emitter *e, int reg) {
+    if (reg & 8)
+        e8(e, 0x41);
+    e8(e, 0x50 + (reg & 7));
+}
+
+static void pop_r(emitter *e, int reg) {
+    if (reg & 8)
+        e8(e, 0x41);
+    e8(e, 0x58 + (reg & 7));
+}
+
+// returns where the rel32 goes so it can be patched
+static uint8_t *jcc(emitter *e, int cc) {
+    e8(e, 0x0f);
+    e8(e, 0x80 + cc);
+    uint8_t *at = e->p;
+    e32(e, 0);
+    return at;
+}
+
+static uint8_t *jmp(emitter *e) {
+    e8(e, 0xe9);
+    uint8_t *at = e->p;
+    e32(e, 0);
+    return at;
+}
+
+static void patch(emitter *e, uint8_t *at, const uint8_t *target) {
+    if (e->full)
+        return;
+    int32_t rel = target - (at + 4);
+    for (int i = 0; i < 4; ++i)
+        at[i] = rel >> (i * 8);
+}
+
+// dst = hi << 8 | lo
+static void pair(emitter *e, int dst, int hi, int lo) {
+    op_rr(e, 0x89, dst, hi);
+    shift_ri(e, 4, false, dst, 8);
+    op_rr(e, 0x09, dst, lo);
+}
+
+static void pair_inc(emitter *e, bool dec, int hi, int lo) {
+    op_ri(e, dec ? 5 : 0, true, lo, 1); // sub/add
+    op_ri(e, dec ? 3 : 2, true, hi, 0); // sbb/adc
+}
+
+static void sp_add(emitter *e, int reg, int n) {
+    op_ri(e, n < 0 ? 5 : 0, false, reg, n < 0 ? -n : n);
+    op_ri(e, 4, false, reg, 0xffff);
+}
+
+// host carry = sm83 carry, for adc/sbc and the rotates through carry
+static void carry_in(emitter *e) {
+    rex(e, false, 0, REG_F, false);
+    e8(e, 0x0f);
+    e8(e, 0xba);
+    modrm(e, 4, REG_F);
+    e8(e, 4);
+}
+
+// f from the host flags of the 8 bit op just before: z, h and c where 'host' says, the
+// rest kept where 'keep' says and then 'set' ored in. x86's auxiliary carry is the half carry
+static void flags_host(emitter *e, uint8_t host, uint8_t keep, uint8_t set) {
+    static const uint8_t lahf[] = {
+        0x9f, // lahf
+        0x0f, 0xb6, 0xc4, // movzx eax, ah: zf at bit 6, af at 4, cf at 0
+        0x89, 0xc1, // mov ecx, eax
+        0x83, 0xe1, 0x50, // and ecx, zf | af
+        0xd1, 0xe1, // shl ecx, 1
+        0x83, 0xe0, 0x01, // and eax, cf
+        0xc1, 0xe0, 0x04, // shl eax, 4
+        0x09, 0xc8, // or eax, ecx
+    };
+    for (size_t i = 0; i < sizeof(lahf); ++i)
+        e8(e, lahf[i]);
+    op_ri(e, 4, false, RAX, host);
+    op_ri(e, 4, false, REG_F, keep);
+    op_rr(e, 0x09, REG_F, RAX);
+    if (set)
+        op_ri(e, 1, false, REG_F, set);
+}
+
+// f = c from the host carry, z from 'reg' being 0 unless it is -1, n and h clear
+static void flags_shift(emitter *e, int reg) {
+    setcc(e, CC_B, RAX);
+    movzx8(e, RAX, RAX);
+    shift_ri(e, 4, false, RAX, 4);
+    if (reg >= 0) {
+        op_rr(e, 0x84, reg, reg);
+        setcc(e, CC_E, RCX);
+        movzx8(e, RCX, RCX);
+        shift_ri(e, 4, false, RCX, 7);
+        op_rr(e, 0x09, RAX, RCX);
+    }
+    op_rr(e, 0x89, REG_F, RAX);
+}
+
+// calls fn(cpu, esi, edx), the sm83 registers in caller saved host registers are kept
+static void call_helper(emitter *e, uintptr_t fn) {
+    static const int saved[] = {R8, R9, R10, R11};
+    for (int i = 0; i < 4; ++i)
+        push_r(e, saved[i]);
+    rex(e, true, RBP, RDI, false);
+    e8(e, 0x89);
+    modrm(e, RBP, RDI); // mov rdi, rbp
+    e8(e, 0x48);
+    e8(e, 0xb8);
+    e64(e, fn); // mov rax, fn
+    e8(e, 0xff);
+    e8(e, 0xd0); // call rax
+    for (int i = 3; i >= 0; --i)
+        pop_r(e, saved[i]);
+}
+
+// leaves before op 'i' if the condition holds, the stubs are written after the block
+static void exit_if(emitter *e, int cc, int i) {
+    e->exits[e->exit_count].jump = jcc(e, cc);
+    e->exits[e->exit_count++].op = i;
+}
+
+// the helper return value in eax says if the access went through
+static void read_helper(emitter *e, uintptr_t fn, int i) {
+    call_helper(e, fn);
+    op_rr(e, 0x85, RAX, RAX);
+    exit_if(e, CC_S, i);
+}
+
+static void write_helper(emitter *e, uintptr_t fn, int i) {
+    call_helper(e, fn);
+    op_rr(e, 0x85, RAX, RAX);
+    exit_if(e, CC_E, i);
+}
+
+static void end_result(emitter *e, uint32_t cycles, uint32_t insts) {
+    e8(e, 0x48);
+    e8(e, 0xb8);
+    e64(e, (uint64_t)cycles << 32 | insts); // mov rax, result
+    patch(e, jmp(e), e->epilogue);
+}
+
+// leaves the block with pc at a known address
+static void end_at(emitter *e, uint16_t pc, uint32_t cycles, uint32_t insts) {
+    e8(e, 0x66);
+    e8(e, 0xc7);
+    e8(e, 0x85);
+    e32(e, offsetof(sm83, pc));
+    e8(e, pc & 0xff);
+    e8(e, pc >> 8); // mov word [rbp + pc], imm16
+    end_result(e, cycles, insts);
+}
+
+// or with pc in 'reg'
+static void end_in(emitter *e, int reg, uint32_t cycles, uint32_t insts) {
+    store_cpu(e, true, reg, offsetof(sm83, pc));
+    end_result(e, cycles, insts);
+}
+
+// pushes the address after op 'i' and leaves for 'target'
+static void call_to(emitter *e, int i, uint16_t target, uint8_t cycles) {
+    op_rr(e, 0x89, RSI, REG_SP);
+    sp_add(e, RSI, -2);
+    mov_ri(e, RDX, e->pc[i + 1]);
+    write_helper(e, (uintptr_t)jit_write16, i);
+    sp_add(e, REG_SP, -2);
+    end_at(e, target, e->cycles[i] + cycles, i + 1);
+}
+
+static void ret_from(emitter *e, int i, uint8_t cycles) {
+    op_rr(e, 0x89, RSI, REG_SP);
+    read_helper(e, (uintptr_t)jit_read16, i);
+    sp_add(e, REG_SP, 2);
+    end_in(e, RAX, e->cycles[i] + cycles, i + 1);
+}
+
+// x86 flags set if a conditional op is taken, its test is emitted first
+static int cond_taken(emitter *e, uint8_t op) {
+    rex(e, false, 0, REG_F, false);
+    e8(e, 0xf7);
+    modrm(e, 0, REG_F);
+    e32(e, op & 0x10 ? FC : FZ); // test r10d, flag
+    return op & 0x08 ? CC_NE : CC_E; // the z/c forms are taken when the flag is set
+}
+
+static void jit_alu_info(op_info *info, int kind) {
+    info->defs = FZ | FN | FH | FC;
+    if (kind == 1 || kind == 3) // adc, sbc
+        info->uses = FC;
+}
+
+static bool jit_info(const block_op *bop, op_info *info) {
+    uint8_t op = bop->op;
+    *info = (op_info){1, 0, 0, false, false};
+    if (op >= 0x40 && op < 0x80) { // ld r, r
+        if (op == 0x76) // halt
+            return false;
+        info->exits = (op & 7) == 6 || (op & 0x38) == 0x30;
+        info->cycles = info->exits ? 2 : 1;
+        return true;
+    }
+    if (op >= 0x80 && op < 0xc0) { // alu a, r
+        info->exits = (op & 7) == 6;
+        info->cycles = info->exits ? 2 : 1;
+        jit_alu_info(info, op >> 3 & 7);
+        return true;
+    }
+    switch (op) {
+        case 0x00: case 0xf3: // nop, di
+            return true;
+        case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x3e:
+            info->cycles = 2;
+            return true;
+        case 0x36:
+            info->cycles = 3;
+            info->exits = true;
+            return true;
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            info->cycles = 3;
+            return true;
+        case 0x02: case 0x12: case 0x22: case 0x32: case 0x0a: case 0x1a: case 0x2a: case 0x3a:
+        case 0xe2: case 0xf2:
+            info->cycles = 2;
+            info->exits = true;
+            return true;
+        case 0x03: case 0x13: case 0x23: case 0x33: case 0x0b: case 0x1b: case 0x2b: case 0x3b:
+            info->cycles = 2;
+            return true;
+        case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x3c:
+        case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x3d:
+            info->defs = FZ | FN | FH;
+            return true;
+        case 0x09: case 0x19: case 0x29: case 0x39:
+            info->cycles = 2;
+            info->defs = FN | FH | FC;
+            return true;
+        case 0x07: case 0x0f:
+            info->defs = FZ | FN | FH | FC;
+            return true;
+        case 0x17: case 0x1f:
+            info->uses = FC;
+            info->defs = FZ | FN | FH | FC;
+            return true;
+        case 0x2f:
+            info->defs = FN | FH;
+            return true;
+        case 0x37:
+            info->defs = FN | FH | FC;
+            return true;
+        case 0x3f:
+            info->uses = FC;
+            info->defs = FN | FH | FC;
+            return true;
+        case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+            info->cycles = 2;
+            jit_alu_info(info, op >> 3 & 7);
+            return true;
+        case 0xe0: case 0xf0:
+            // only hram, and writing interrupt enable has to stop the cpu
+            if (bop->imm < 0x80 || (op == 0xe0 && bop->imm == 0xff))
+                return false;
+            info->cycles = 3;
+            return true;
+        case 0xea: case 0xfa:
+            info->cycles = 4;
+            info->exits = true;
+            return true;
+        case 0xcb:
+            if ((bop->imm & 7) == 6) // (hl)
+                return false;
+            info->cycles = 2;
+            if (bop->imm < 0x40) {
+                info->defs = FZ | FN | FH | FC;
+                if ((bop->imm & 0xf0) == 0x10) // rl, rr
+                    info->uses = FC;
+            } else if (bop->imm < 0x80) {
+                info->defs = FZ | FN | FH;
+            }
+            return true;
+        case 0xc5: case 0xd5: case 0xe5: case 0xf5:
+            info->cycles = 4;
+            info->exits = true;
+            return true;
+        case 0xc1: case 0xd1: case 0xe1: case 0xf1:
+            info->cycles = 3;
+            info->exits = true;
+            if (op == 0xf1)
+                info->defs = FZ | FN | FH | FC;
+            return true;
+        case 0x18:
+            info->cycles = 3;
+            info->ends = true;
+            return true;
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            *info = (op_info){2, op & 0x10 ? FC : FZ, 0, false, true};
+            return true;
+        case 0xc3:
+            info->cycles = 4;
+            info->ends = true;
+            return true;
+        case 0xc2: case 0xca: case 0xd2: case 0xda:
+            *info = (op_info){3, op & 0x10 ? FC : FZ, 0, false, true};
+            return true;
+        case 0xe9:
+            info->ends = true;
+            return true;
+        case 0xcd:
+            *info = (op_info){6, 0, 0, true, true};
+            return true;
+        case 0xc4: case 0xcc: case 0xd4: case 0xdc:
+            *info = (op_info){3, op & 0x10 ? FC : FZ, 0, true, true};
+            return true;
+        case 0xc9:
+            *info = (op_info){4, 0, 0, true, true};
+            return true;
+        case 0xc0: case 0xc8: case 0xd0: case 0xd8:
+            *info = (op_info){2, op & 0x10 ? FC : FZ, 0, true, true};
+            return true;
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+            *info = (op_info){4, 0, 0, true, true};
+            return true;
+        default: // daa, (hl) read-modify-write, stack pointer arithmetic, i/o, halt, stop, ei and reti
+            return false;
+    }
+}
+
+// x86 8 bit forms of add adc sub sbc and xor or cp, and the same as immediate group digits
+static const uint8_t alu_op[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+static const uint8_t alu_digit[8] = {0, 2, 5, 3, 4, 6, 1, 7};
+
+static void alu(emitter *e, int kind, int src, bool imm, uint8_t val, uint8_t need) {
+    if (kind == 1 || kind == 3)
+        carry_in(e);
+    if (imm)
+        op_ri(e, alu_digit[kind], true, REG_A, val);
+    else
+        op_rr(e, alu_op[kind], REG_A, src);
+    if (!need)
+        return;
+    switch (kind) {
+        case 0: case 1: flags_host(e, FZ | FH | FC, 0, 0); break;
+        case 2: case 3: case 7: flags_host(e, FZ | FH | FC, 0, FN); break;
+        case 4: flags_host(e, FZ, 0, FH); break;
+        default: flags_host(e, FZ, 0, 0); break;
+    }
+}
+
+// cb prefixed ops on a register
+static void cb_op(emitter *e, uint8_t cb, uint8_t need) {
+    static const uint8_t shift_digit[8] = {0, 1, 2, 3, 4, 7, 0, 5}; // rol ror rcl rcr shl sar (swap) shr
+    int reg = gb_reg[cb & 7], bit = cb >> 3 & 7;
+    switch (cb >> 6) {
+        case 0:
+            if (bit == 2 || bit == 3)
+                carry_in(e);
+            if (bit == 6) { // swap
+                shift_ri(e, 0, true, reg, 4);
+                if (need) {
+                    op_rr(e, 0x84, reg, reg);
+                    setcc(e, CC_E, RAX);
+                    movzx8(e, REG_F, RAX);
+                    shift_ri(e, 4, false, REG_F, 7);
+                }
+            } else {
+                shift_ri(e, shift_digit[bit], true, reg, 1);
+                if (need)
+                    flags_shift(e, reg);
+            }
+            break;
+        case 1: // bit
+            if (need) {
+                test_ri8(e, reg, 1 << bit);
+                setcc(e, CC_E, RAX);
+                movzx8(e, RAX, RAX);
+                shift_ri(e, 4, false, RAX, 7);
+                op_ri(e, 4, false, REG_F, FC);
+                op_rr(e, 0x09, REG_F, RAX);
+                op_ri(e, 1, false, REG_F, FH);
+            }
+            break;
+        case 2: op_ri(e, 4, false, reg, ~(1u << bit) & 0xff); break; // res
+        case 3: op_ri(e, 1, false, reg, 1u << bit); break; // set
+    }
+}
+
+// emits op 'i', 'need' being the flags it writes that something reads later
+static void emit_op(emitter *e, const block_op *bop, int i, uint8_t need) {
+    static const int8_t pair_hi[4] = {R12, R14, R8, -1}, pair_lo[4] = {R13, R15, R9, -1};
+    uint8_t op = bop->op;
+    uint16_t imm = bop->imm;
+    int rr = op >> 4 & 3;
+    if (op >= 0x40 && op < 0x80) {
+        int dst = op >> 3 & 7, src = op & 7;
+        if (src == 6) {
+            pair(e, RSI, R8, R9);
+            read_helper(e, (uintptr_t)jit_read8, i);
+            op_rr(e, 0x89, gb_reg[dst], RAX);
+        } else if (dst == 6) {
+            pair(e, RSI, R8, R9);
+            op_rr(e, 0x89, RDX, gb_reg[src]);
+            write_helper(e, (uintptr_t)jit_write8, i);
+        } else if (dst != src) {
+            op_rr(e, 0x89, gb_reg[dst], gb_reg[src]);
+        }
+        return;
+    }
+    if (op >= 0x80 && op < 0xc0) {
+        int src = gb_reg[op & 7];
+        if ((op & 7) == 6) {
+            pair(e, RSI, R8, R9);
+            read_helper(e, (uintptr_t)jit_read8, i);
+            src = RAX;
+        }
+        alu(e, op >> 3 & 7, src, false, 0, need);
+        return;
+    }
+    switch (op) {
+        case 0x00: // nop
+            break;
+        case 0xf3: // di
+            e8(e, 0xc6);
+            e8(e, 0x85);
+            e32(e, offsetof(sm83, ime));
+            e8(e, 0); // mov byte [rbp + ime], 0
+            break;
+        case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x3e:
+            mov_ri(e, gb_reg[op >> 3 & 7], imm);
+            break;
+        case 0x36:
+            pair(e, RSI, R8, R9);
+            mov_ri(e, RDX, imm);
+            write_helper(e, (uintptr_t)jit_write8, i);
+            break;
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            if (rr == 3) {
+                mov_ri(e, REG_SP, imm);
+            } else {
+                mov_ri(e, pair_hi[rr], imm >> 8);
+                mov_ri(e, pair_lo[rr], imm & 0xff);
+            }
+            break;
+        case 0x02: case 0x12: case 0x22: case 0x32:
+            if (rr < 2)
+                pair(e, RSI, pair_hi[rr], pair_lo[rr]);
+            else
+                pair(e, RSI, R8, R9);
+            op_rr(e, 0x89, RDX, REG_A);
+            write_helper(e, (uintptr_t)jit_write8, i);
+            if (rr >= 2) // hl+, hl-
+                pair_inc(e, rr == 3, R8, R9);
+            break;
+        case 0x0a: case 0x1a: case 0x2a: case 0x3a:
+            if (rr < 2)
+                pair(e, RSI, pair_hi[rr], pair_lo[rr]);
+            else
+                pair(e, RSI, R8, R9);
+            read_helper(e, (uintptr_t)jit_read8, i);
+            op_rr(e, 0x89, REG_A, RAX);
+            if (rr >= 2)
+                pair_inc(e, rr == 3, R8, R9);
+            break;
+        case 0xe2:
+            op_rr(e, 0x89, RSI, R13);
+            op_ri(e, 1, false, RSI, 0xff00);
+            op_rr(e, 0x89, RDX, REG_A);
+            write_helper(e, (uintptr_t)jit_write8, i);
+            break;
+        case 0xf2:
+            op_rr(e, 0x89, RSI, R13);
+            op_ri(e, 1, false, RSI, 0xff00);
+            read_helper(e, (uintptr_t)jit_read8, i);
+            op_rr(e, 0x89, REG_A, RAX);
+            break;
+        case 0x03: case 0x13: case 0x23: case 0x33: case 0x0b: case 0x1b: case 0x2b: case 0x3b:
+            if (rr == 3)
+                sp_add(e, REG_SP, op & 8 ? -1 : 1);
+            else
+                pair_inc(e, op & 8, pair_hi[rr], pair_lo[rr]);
+            break;
+        case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x3c:
+        case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x3d:
+            incdec8(e, op & 1, gb_reg[op >> 3 & 7]);
+            if (need)
+                flags_host(e, FZ | FH, FC, op & 1 ? FN : 0);
+            break;
+        case 0x09: case 0x19: case 0x29: case 0x39:
+            pair(e, RAX, R8, R9);
+            if (rr == 3)
+                op_rr(e, 0x89, RCX, REG_SP);
+            else
+                pair(e, RCX, pair_hi[rr], pair_lo[rr]);
+            if (need) { // h from bit 11, c from bit 15, z kept
+                op_rr(e, 0x89, RDX, RAX);
+                op_ri(e, 4, false, RDX, 0xfff);
+                op_rr(e, 0x89, RSI, RCX);
+                op_ri(e, 4, false, RSI, 0xfff);
+                op_rr(e, 0x01, RDX, RSI);
+                shift_ri(e, 5, false, RDX, 7);
+                op_ri(e, 4, false, RDX, FH);
+            }
+            op_rr(e, 0x01, RAX, RCX);
+            if (need) {
+                op_rr(e, 0x89, RSI, RAX);
+                shift_ri(e, 5, false, RSI, 12);
+                op_ri(e, 4, false, RSI, FC);
+                op_ri(e, 4, false, REG_F, FZ);
+                op_rr(e, 0x09, REG_F, RDX);
+                op_rr(e, 0x09, REG_F, RSI);
+            }
+            movzx8(e, R9, RAX);
+            shift_ri(e, 5, false, RAX, 8);
+            movzx8(e, R8, RAX);
+            break;
+        case 0x07: case 0x0f: case 0x17: case 0x1f: // rlca rrca rla rra, z is always clear
+            if (op >= 0x10)
+                carry_in(e);
+            shift_ri(e, op >> 3 & 3, true, REG_A, 1);
+            if (need)
+                flags_shift(e, -1);
+            break;
+        case 0x2f: // cpl
+            op_ri(e, 6, false, REG_A, 0xff);
+            if (need)
+                op_ri(e, 1, false, REG_F, FN | FH);
+            break;
+        case 0x37: // scf
+            if (need) {
+                op_ri(e, 4, false, REG_F, FZ);
+                op_ri(e, 1, false, REG_F, FC);
+            }
+            break;
+        case 0x3f: // ccf
+            if (need) {
+                op_ri(e, 4, false, REG_F, FZ | FC);
+                op_ri(e, 6, false, REG_F, FC);
+            }
+            break;
+        case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+            alu(e, op >> 3 & 7, -1, true, imm, need);
+            break;
+        case 0xe0: case 0xf0: // straight into hram
+            if (op == 0xe0 && e->check) { // so the write gets logged
+                mov_ri(e, RSI, 0xff00 | imm);
+                op_rr(e, 0x89, RDX, REG_A);
+                call_helper(e, (uintptr_t)jit_write8);
+                break;
+            }
+            e8(e, 0x48);
+            e8(e, 0x8b);
+            e8(e, 0x95);
+            e32(e, offsetof(sm83, mmu)); // mov rdx, [rbp + mmu]
+            if (op == 0xf0) {
+                e8(e, 0x0f);
+                e8(e, 0xb6);
+            } else {
+                e8(e, 0x88);
+            }
+            e8(e, 0x9a);
+            e32(e, offsetof(_mmu, hram) + imm - 0x80); // movzx ebx, / mov byte [rdx + hram], bl
+            break;
+        case 0xea:
+            mov_ri(e, RSI, imm);
+            op_rr(e, 0x89, RDX, REG_A);
+            write_helper(e, (uintptr_t)jit_write8, i);
+            break;
+        case 0xfa:
+            mov_ri(e, RSI, imm);
+            read_helper(e, (uintptr_t)jit_read8, i);
+            op_rr(e, 0x89, REG_A, RAX);
+            break;
+        case 0xcb:
+            cb_op(e, imm, need);
+            break;
+        case 0xc5: case 0xd5: case 0xe5: case 0xf5:
+            if (rr == 3) {
+                pair(e, RDX, REG_A, REG_F);
+                op_ri(e, 4, false, RDX, 0xfff0);
+            } else {
+                pair(e, RDX, pair_hi[rr], pair_lo[rr]);
+            }
+            op_rr(e, 0x89, RSI, REG_SP);
+            sp_add(e, RSI, -2);
+            write_helper(e, (uintptr_t)jit_write16, i);
+            sp_add(e, REG_SP, -2);
+            break;
+        case 0xc1: case 0xd1: case 0xe1: case 0xf1:
+            op_rr(e, 0x89, RSI, REG_SP);
+            read_helper(e, (uintptr_t)jit_read16, i);
+            sp_add(e, REG_SP, 2);
+            if (rr == 3) {
+                movzx8(e, REG_F, RAX);
+                op_ri(e, 4, false, REG_F, 0xf0);
+                shift_ri(e, 5, false, RAX, 8);
+                op_rr(e, 0x89, REG_A, RAX);
+            } else {
+                movzx8(e, pair_lo[rr], RAX);
+                shift_ri(e, 5, false, RAX, 8);
+                op_rr(e, 0x89, pair_hi[rr], RAX);
+            }
+            break;
+        case 0x18:
+            end_at(e, e->pc[i + 1] + (int8_t)imm, e->cycles[i] + 3, i + 1);
+            break;
+        case 0x20: case 0x28: case 0x30: case 0x38: {
+            uint8_t *taken = jcc(e, cond_taken(e, op));
+            end_at(e, e->pc[i + 1], e->cycles[i] + 2, i + 1);
+            patch(e, taken, e->p);
+            end_at(e, e->pc[i + 1] + (int8_t)imm, e->cycles[i] + 3, i + 1);
+            break;
+        }
+        case 0xc3:
+            end_at(e, imm, e->cycles[i] + 4, i + 1);
+            break;
+        case 0xc2: case 0xca: case 0xd2: case 0xda: {
+            uint8_t *taken = jcc(e, cond_taken(e, op));
+            end_at(e, e->pc[i + 1], e->cycles[i] + 3, i + 1);
+            patch(e, taken, e->p);
+            end_at(e, imm, e->cycles[i] + 4, i + 1);
+            break;
+        }
+        case 0xe9:
+            pair(e, RCX, R8, R9);
+            end_in(e, RCX, e->cycles[i] + 1, i + 1);
+            break;
+        case 0xcd:
+            call_to(e, i, imm, 6);
+            break;
+        case 0xc4: case 0xcc: case 0xd4: case 0xdc: {
+            uint8_t *taken = jcc(e, cond_taken(e, op));
+            end_at(e, e->pc[i + 1], e->cycles[i] + 3, i + 1);
+            patch(e, taken, e->p);
+            call_to(e, i, imm, 6);
+            break;
+        }
+        case 0xc9:
+            ret_from(e, i, 4);
+            break;
+        case 0xc0: case 0xc8: case 0xd0: case 0xd8: {
+            uint8_t *taken = jcc(e, cond_taken(e, op));
+            end_at(e, e->pc[i + 1], e->cycles[i] + 2, i + 1);
+            patch(e, taken, e->p);
+            ret_from(e, i, 5);
+            break;
+        }
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+            call_to(e, i, op & 0x38, 4);
+            break;
+    }
+}
+
+// entry: keeps the callee saved registers, loads the sm83 ones and jumps to the block.
+// epilogue: stores them back, the block has left the result in rax
+static void jit_trampoline(jit *self) {
+    static const struct {
+        int8_t reg;
+        bool word;
+        uint8_t off;
+    } regs[] = {
+        {REG_A, false, offsetof(sm83, af) + HI}, {REG_F, false, offsetof(sm83, af) + LO},
+        {R12, false, offsetof(sm83, bc) + HI}, {R13, false, offsetof(sm83, bc) + LO},
+        {R14, false, offsetof(sm83, de) + HI}, {R15, false, offsetof(sm83, de) + LO},
+        {R8, false, offsetof(sm83, hl) + HI}, {R9, false, offsetof(sm83, hl) + LO},
+        {REG_SP, true, offsetof(sm83, sp)},
+    };
+    static const int callee[] = {RBX, RBP, R12, R13, R14, R15};
+    emitter e = {.p = self->code, .end = self->code + JIT_CODE_SIZE};
+    for (int i = 0; i < 6; ++i)
+        push_r(&e, callee[i]);
+    static const uint8_t enter[] = {
+        0x48, 0x83, 0xec, 0x08, // sub rsp, 8 to keep calls aligned
+        0x48, 0x89, 0xfd, // mov rbp, rdi
+    };
+    for (size_t i = 0; i < sizeof(enter); ++i)
+        e8(&e, enter[i]);
+    for (size_t i = 0; i < sizeof(regs) / sizeof(*regs); ++i)
+        load_cpu(&e, regs[i].word, regs[i].reg, regs[i].off);
+    e8(&e, 0xff);
+    e8(&e, 0xe6); // jmp rsi
+    self->epilogue = e.p;
+    for (size_t i = 0; i < sizeof(regs) / sizeof(*regs); ++i)
+        store_cpu(&e, regs[i].word, regs[i].reg, regs[i].off);
+    static const uint8_t leave[] = {0x48, 0x83, 0xc4, 0x08}; // add rsp, 8
+    for (size_t i = 0; i < sizeof(leave); ++i)
+        e8(&e, leave[i]);
+    for (int i = 5; i >= 0; --i)
+        pop_r(&e, callee[i]);
+    e8(&e, 0xc3); // ret
+    self->enter = (uint64_t (*)(void *, const void *))(uintptr_t)self->code;
+    self->base = self->used = e.p - self->code;
+}
+
+// the cache is never writable and executable at once, kernels that enforce w^x refuse that.
+// only the pages a block is being compiled into are made writable, and only while it is
+static bool jit_protect(jit *self, size_t from, size_t to, bool write) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    from &= ~(page - 1);
+    return !mprotect(self->code + from, to - from, write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+jit *jit_new(bool check) {
+    jit *self = calloc(1, sizeof(jit));
+    if (!self)
+        return NULL;
+    self->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->code == MAP_FAILED) {
+        int err = errno;
+        free(self);
+        errno = err;
+        return NULL;
+    }
+    self->check = check;
+    jit_trampoline(self);
+    if (!jit_protect(self, 0, JIT_CODE_SIZE, false)) {
+        int err = errno;
+        jit_free(self);
+        errno = err;
+        return NULL;
+    }
+    return self;
+}
+
+void jit_free(jit *self) {
+    if (!self)
+        return;
+    munmap(self->code, JIT_CODE_SIZE);
+    free(self);
+}
+
+// throws every compiled block away, they get compiled again once they are hot
+static void jit_flush(jit *self, block_cache *cache) {
+    for (int i = 0; i < BLOCK_SLOTS; ++i) {
+        cache->slots[i].native = NULL;
+        cache->slots[i].heat = 0;
+    }
+    self->used = self->base; // the trampoline stays where it is
+    ++self->flushes;
+}
+
+void jit_compile(jit *self, block_cache *cache, block *b) {
+    b->native = NULL;
+    if (JIT_CODE_SIZE - self->used < JIT_BLOCK_MAX)
+        jit_flush(self, cache);
+    b->heat = JIT_HOT; // also when it can't be compiled, so it isn't tried again
+
+    emitter e = {
+        .p = self->code + self->used, .end = self->code + self->used + JIT_BLOCK_MAX,
+        .check = self->check, .epilogue = self->epilogue,
+    };
+    op_info info[BLOCK_OPS];
+    int n = 0;
+    e.pc[0] = b->pc;
+    e.cycles[0] = 0;
+    while (n < b->len && jit_info(&b->ops[n], &info[n])) {
+        e.pc[n + 1] = e.pc[n] + block_op_size(b->ops[n].op);
+        e.cycles[n + 1] = e.cycles[n] + info[n].cycles;
+        if (info[n++].ends)
+            break;
+    }
+    // running part of a block natively and the rest through the interpreter costs more than it saves
+    if (n < b->len)
+        return;
+
+    // flags are only worked out if something reads them before they're overwritten, everything
+    // is live where the block ends or may leave early so the interpreter can carry on from there
+    uint8_t live[BLOCK_OPS];
+    live[n - 1] = FZ | FN | FH | FC;
+    for (int i = n - 1; i > 0; --i)
+        live[i - 1] = info[i].exits ? FZ | FN | FH | FC : (live[i] & ~info[i].defs) | info[i].uses;
+
+    if (!jit_protect(self, self->used, self->used + JIT_BLOCK_MAX, true))
+        return;
+    uint8_t *start = e.p;
+    for (int i = 0; i < n; ++i)
+        emit_op(&e, &b->ops[i], i, info[i].defs & live[i]);
+    if (!info[n - 1].ends) // split for being too long
+        end_at(&e, e.pc[n], e.cycles[n], n);
+    for (int i = 0; i < e.exit_count; ++i) {
+        int op = e.exits[i].op;
+        patch(&e, e.exits[i].jump, e.p);
+        end_at(&e, e.pc[op], e.cycles[op], op);
+    }
+    // blocks compiled before that share the first page couldn't run either if it doesn't go back
+    if (!jit_protect(self, self->used, self->used + JIT_BLOCK_MAX, false)) {
+        jit_flush(self, cache);
+        return;
+    }
+    if (e.full)
+        return;
+    self->used = e.p - self->code;
+    b->native = start;
+    b->native_cycles = e.cycles[n - 1];
+    ++self->compiled;
+}
+
+void jit_undo(jit *self, _mmu *mmu) {
+    for (unsigned i = self->log_len; i-- > 0;)
+        *jit_writable(mmu, self->log[i].addr) = self->log[i].old;
+}
+
+bool jit_matches(const jit *self, _mmu *mmu) {
+    for (unsigned i = 0; i < self->log_len; ++i) {
+        bool last = true; // only the final value of each address counts
+        for (unsigned j = i + 1; j < self->log_len; ++j)
+            last &= self->log[j].addr != self->log[i].addr;
+        if (last && *jit_readable(mmu, self->log[i].addr) != self->log[i].val)
+            return false;
+    }
+    return true;
+}
+
+void jit_mismatch(jit *self, block *b, const char *what) {
+    ++self->mismatches;
+    fprintf(stderr, "jit: %s of the block at %03x:%04x differ from the interpreter, interpreting it from now on\n",
+        what, b->bank, b->pc);
+    b->native = NULL; // heat stays at JIT_HOT so it is never compiled again
+}
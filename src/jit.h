@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "mmu.h"
+
+// translates hot rom blocks into x86-64, only built with -Djit=true. compiled code keeps
+// the registers in host registers, only works out the flags something reads and leaves
+// through a side exit before anything that isn't plain memory (i/o, watched wram, the mapper)
+#define JIT_HOT 16 // runs through the block interpreter before a block is compiled
+#define JIT_CODE_SIZE (4 << 20)
+#define JIT_BLOCK_MAX 8192 // more than the longest block can compile to
+#define JIT_LOG 64 // two writes for each op of the longest block
+
+typedef struct {
+    uint16_t addr;
+    uint8_t old, val;
+} jit_write;
+
+typedef struct {
+    uint8_t *code; // one mapping for the whole cache, flushed when it fills up
+    size_t used, base; // blocks go after the trampoline, from 'base'
+
+    // loads the registers from the sm83 at 'cpu', runs 'native' and stores them back,
+    // returns the m-cycles it took << 32 | the instructions it ran
+    uint64_t (*enter)(void *cpu, const void *native);
+    const uint8_t *epilogue;
+    // check mode: every write the native code makes is logged so it can be undone and the
+    // same instructions run through the interpreter to compare against
+    bool check;
+    jit_write log[JIT_LOG];
+    unsigned log_len;
+    uint64_t compiled, flushes, mismatches;
+} jit;
+
+// returns NULL with errno set if no executable memory can be had
+jit *jit_new(bool check);
+void jit_free(jit *self);
+// compiles 'b', leaving native NULL if any of its ops can't be compiled
+void jit_compile(jit *self, block_cache *cache, block *b);
+// check mode, puts back what the last run wrote / tells if memory now holds the same
+void jit_undo(jit *self, _mmu *mmu);
+bool jit_matches(const jit *self, _mmu *mmu);
+// reports 'b' on stderr and goes back to interpreting it for good
+void jit_mismatch(jit *self, block *b, const char *what);
@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#include "joypad.h"
+#include "mmu.h"
+
+// p10-p13, pulled high and low for each held button in a selected row
+static uint8_t joypad_lines(const joypad *self) {
+    uint8_t held = 0;
+    if (!(self->select & 0x10))
+        held |= self->buttons & 0x0f;
+    if (!(self->select & 0x20))
+        held |= self->buttons >> 4;
+    return ~held & 0x0f;
+}
+
+// any line going from high to low requests the interrupt
+static uint8_t joypad_edge(uint8_t before, uint8_t after) {
+    return before & ~after ? INT_JOYPAD : 0;
+}
+
+void joypad_init(joypad *self) {
+    self->select = 0x30;
+    self->buttons = 0;
+}
+
+uint8_t joypad_read(const joypad *self) {
+    return 0xc0 | self->select | joypad_lines(self);
+}
+
+uint8_t joypad_write(joypad *self, uint8_t val) {
+    uint8_t before = joypad_lines(self);
+    self->select = val & 0x30;
+    return joypad_edge(before, joypad_lines(self));
+}
+
+uint8_t joypad_set(joypad *self, uint8_t buttons) {
+    uint8_t before = joypad_lines(self);
+    self->buttons = buttons;
+    return joypad_edge(before, joypad_lines(self));
+}
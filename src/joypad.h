@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// the buttons as one byte, the order 0xff00 reads them in with the directions low
+#define JOYPAD_RIGHT 0x01
+#define JOYPAD_LEFT 0x02
+#define JOYPAD_UP 0x04
+#define JOYPAD_DOWN 0x08
+#define JOYPAD_A 0x10
+#define JOYPAD_B 0x20
+#define JOYPAD_SELECT 0x40
+#define JOYPAD_START 0x80
+
+typedef struct {
+    uint8_t select; // bits 4 and 5 of 0xff00 as written, a 0 selects the directions or the buttons
+    uint8_t buttons; // held ones are set
+} joypad;
+
+void joypad_init(joypad *self);
+uint8_t joypad_read(const joypad *self);
+// these return the interrupts to request, the joypad one when a line goes low
+uint8_t joypad_write(joypad *self, uint8_t val);
+uint8_t joypad_set(joypad *self, uint8_t buttons);
@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "link.h"
+
+void link_plug(_mmu *self, bool on) {
+    self->link.plugged = on;
+    self->link.sent = false;
+}
+
+link_msg link_take(_mmu *self) {
+    link_msg msg = {self->link.sent, 0, self->link.sent_byte};
+    if (msg.sent) {
+        uint64_t ago = self->sched.now - self->link.sent_time;
+        msg.ago = ago < SERIAL_CYCLES ? ago : SERIAL_CYCLES;
+    }
+    self->link.sent = false;
+    return msg;
+}
+
+uint8_t link_receive(_mmu *self, link_msg in) {
+    if (!in.sent || !self->link.plugged || (self->io[0x02] & 0x81) != 0x80)
+        return 0xff;
+    // finishes when it does on the side clocking it, by when that side has the answer
+    self->serial_in = in.byte;
+    sched_set(&self->sched, EV_SERIAL, self->sched.now - in.ago + SERIAL_CYCLES);
+    return self->io[0x01];
+}
+
+void link_answer(_mmu *self, link_msg sent, uint8_t reply) {
+    if (sent.sent)
+        self->serial_in = reply;
+}
+
+// both ends are at the end of the same slice
+static void link_exchange(_mmu *a, _mmu *b) {
+    link_msg from_a = link_take(a), from_b = link_take(b);
+    uint8_t to_a = link_receive(b, from_a), to_b = link_receive(a, from_b);
+    link_answer(a, from_a, to_a);
+    link_answer(b, from_b, to_b);
+}
+
+// runs up to 'end', wherever the last slice overshot to
+static void link_slice(sm83 *cpu, uint64_t end) {
+    uint64_t now = cpu->mmu->sched.now;
+    if (now < end)
+        sm83_run(cpu, end - now);
+}
+
+// a run of 'cycles' on one side, both start it together and every slice ends at the barrier
+static void link_cable_side(link_cable *self, int side, uint64_t cycles) {
+    sm83 *cpu = self->cpu[side];
+    uint64_t start = cpu->mmu->sched.now;
+    for (uint64_t done = 0; done < cycles;) {
+        done += cycles - done < LINK_SLICE ? cycles - done : LINK_SLICE;
+        link_slice(cpu, start + done);
+        // whichever gets here last swaps what went over the cable while the other waits
+        if (pthread_barrier_wait(&self->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+            link_exchange(self->cpu[0]->mmu, self->cpu[1]->mmu);
+        pthread_barrier_wait(&self->barrier);
+    }
+}
+
+// the second side, it waits at the barrier for each run to start until one of 0 cycles stops it
+static void *link_cable_thread(void *arg) {
+    link_cable *self = arg;
+    for (;;) {
+        pthread_barrier_wait(&self->barrier);
+        uint64_t cycles = self->cycles; // only changes once this run's last slice is done
+        if (!cycles)
+            return NULL;
+        link_cable_side(self, 1, cycles);
+    }
+}
+
+bool link_cable_init(link_cable *self, sm83 *a, sm83 *b) {
+    self->cpu[0] = a;
+    self->cpu[1] = b;
+    self->cycles = 0;
+    if (pthread_barrier_init(&self->barrier, NULL, 2))
+        return false;
+    if (pthread_create(&self->thread, NULL, link_cable_thread, self)) {
+        pthread_barrier_destroy(&self->barrier);
+        return false;
+    }
+    link_plug(a->mmu, true);
+    link_plug(b->mmu, true);
+    return true;
+}
+
+void link_cable_deinit(link_cable *self) {
+    self->cycles = 0;
+    pthread_barrier_wait(&self->barrier);
+    pthread_join(self->thread, NULL);
+    pthread_barrier_destroy(&self->barrier);
+    link_plug(self->cpu[0]->mmu, false);
+    link_plug(self->cpu[1]->mmu, false);
+}
+
+void link_cable_run(link_cable *self, uint64_t cycles) {
+    if (!cycles)
+        return;
+    self->cycles = cycles;
+    pthread_barrier_wait(&self->barrier);
+    link_cable_side(self, 0, cycles);
+}
+
+int link_socket_open(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        return fd;
+    // nobody is listening, so this side does. only a socket left behind by a run that died is
+    // removed first, anything else at 'path' is left alone and it's an error
+    struct stat st;
+    if (errno == ECONNREFUSED && !lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    } else if (errno != ENOENT) {
+        int err = errno == ECONNREFUSED ? ENOTSOCK : errno; // refused by something that isn't a socket
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    int peer = -1;
+    if (!bind(fd, (struct sockaddr *)&addr, sizeof(addr)) && !listen(fd, 1)) {
+        while ((peer = accept(fd, NULL, NULL)) == -1 && errno == EINTR)
+            ;
+        unlink(path); // connected, nobody else needs to find it
+    }
+    int err = errno;
+    close(fd);
+    errno = err;
+    return peer;
+}
+
+static bool link_send(int fd, const uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL); // a closed socket is an error, not a signal
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool link_recv(int fd, uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// the same exchange with each side doing its half, the answers only go over if something was sent
+static bool link_socket_exchange(int fd, _mmu *mmu) {
+    link_msg mine = link_take(mmu);
+    uint8_t buf[6] = {mine.sent, mine.ago, mine.ago >> 8, mine.ago >> 16, mine.ago >> 24, mine.byte};
+    if (!link_send(fd, buf, sizeof(buf)) || !link_recv(fd, buf, sizeof(buf)))
+        return false;
+    link_msg theirs = {buf[0], buf[1] | buf[2] << 8 | buf[3] << 16 | (uint32_t)buf[4] << 24, buf[5]};
+    if (!mine.sent && !theirs.sent)
+        return true;
+    uint8_t reply = link_receive(mmu, theirs);
+    if (!link_send(fd, &reply, 1) || !link_recv(fd, &reply, 1))
+        return false;
+    link_answer(mmu, mine, reply);
+    return true;
+}
+
+bool link_socket_run(int fd, sm83 *cpu, uint64_t cycles) {
+    uint64_t start = cpu->mmu->sched.now;
+    for (uint64_t done = 0; done < cycles;) {
+        done += cycles - done < LINK_SLICE ? cycles - done : LINK_SLICE;
+        link_slice(cpu, start + done);
+        if (cpu->mmu->link.plugged && !link_socket_exchange(fd, cpu->mmu))
+            link_plug(cpu->mmu, false);
+    }
+    return cpu->mmu->link.plugged;
+}
+
+void link_socket_close(int fd) {
+    close(fd);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+// linked instances run this many m-cycles between exchanges. a transfer takes at least as
+// long, so one clocked out in a slice is answered before it finishes on the side that sent it
+#define LINK_SLICE SERIAL_CYCLES
+
+// a transfer one side clocked out during the last slice
+typedef struct {
+    bool sent;
+    uint32_t ago; // m-cycles before the end of the slice it started
+    uint8_t byte;
+} link_msg;
+
+// the exchange between slices, for carrying over any transport: each side takes what it
+// sent, hands it to the other to receive, then gets the other's answer back
+void link_plug(_mmu *self, bool on);
+link_msg link_take(_mmu *self);
+// the other side's transfer reaches this one, which shifts it in if it's waiting on an
+// external clock. returns what it shifts back out, 1s if it wasn't waiting
+uint8_t link_receive(_mmu *self, link_msg in);
+// what came back for the transfer in 'sent', if there was one
+void link_answer(_mmu *self, link_msg sent, uint8_t reply);
+
+// two instances in this process on a cable, the second runs on a thread kept for as long as
+// the cable is plugged in
+typedef struct {
+    sm83 *cpu[2];
+    pthread_t thread;
+    pthread_barrier_t barrier;
+    uint64_t cycles; // how long the current run is, 0 stops the thread
+} link_cable;
+
+// plugs both in and starts the thread for the second, false if it couldn't be started
+bool link_cable_init(link_cable *self, sm83 *a, sm83 *b);
+void link_cable_deinit(link_cable *self);
+// runs both for 'cycles' in lockstep slices, the first on the calling thread, and returns
+// once both are done
+void link_cable_run(link_cable *self, uint64_t cycles);
+
+// one end of a cable to another process over the unix socket at 'path': whichever side gets
+// there first listens and waits for the other to connect. a stale socket at 'path' is replaced,
+// anything else there is an error. returns the socket or -1 with errno set
+int link_socket_open(const char *path);
+// runs 'cpu', plugged in with link_plug, for 'cycles' in slices, exchanging with the other end
+// after each. the other end has to run the same number of cycles at a time. false once it has
+// gone away, 'cpu' is then unplugged and runs on by itself
+bool link_socket_run(int fd, sm83 *cpu, uint64_t cycles);
+void link_socket_close(int fd);
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -6,15 +7,41 @@
 #include <unistd.h>
 
 #include "cpu.h"
+#include "gui.h"
+#include "link.h"
+#include "movie.h"
+#include "rewind.h"
+#include "rom.h"
+
+#ifdef DEBUG // print contents of serial port to terminal
+static void serial_print(void *ctx, uint8_t byte) {
+    (void)ctx;
+    fprintf(stderr, "%c", byte);
+}
+#endif
 
 int main(int argc, char **argv) {
     const char *help = "gameboff [options] rom...\n"
                        "Options:\n"
                        "    -b [bootrom] Use bootrom 'bootrom'\n"
+                       "    -t [file]    Record every instruction to 'file', see gameboff-tracefmt\n"
+                       "    -B           Run from the cache of decoded blocks instead of fetching every byte\n"
+                       "    -J           Compile hot blocks to x86-64 (needs -Djit=true)\n"
+                       "    -A           Give every memory access its own m-cycle, slower but right for timing sensitive roms\n"
+                       "    -p [file]    Write the opcode and pc profile to 'file' at exit, csv or .json (needs -Dprofile=true)\n"
+                       "    -m [file]    Record the buttons held in every frame to the input movie 'file'\n"
+                       "    -M [file]    Play the input movie 'file' from power on, with -H stop at its end and print the frame hash\n"
+                       "    -L [socket]  Plug a link cable into another gameboff started with the same socket path\n"
+                       "    -R [MiB]     Keep 'MiB' of history for backspace to rewind through (default 8, 0 for none)\n"
+                       "    -H           Run without a window as fast as possible until the rom locks up\n"
                        "    -h           Returns help menu\n"
                        "    -v           Returns the program version\n";
-    FILE *bootrom_f = NULL, *rom_f = NULL;
-    uint8_t *bootrom = NULL, *rom = NULL;
+    FILE *bootrom_f = NULL;
+    uint8_t *bootrom = NULL;
+    const char *trace_path = NULL, *profile_path = NULL, *record_path = NULL, *play_path = NULL, *link_path = NULL;
+    bool blocks = false, jit = false, accurate = false, headless = false;
+    size_t rewind_mb = GUI_REWIND_MB;
+    rom_image rom;
     if (argc == 1) {
         fprintf(stderr, "No ROM path specified\n%s", help);
         return 1;
@@ -33,6 +60,57 @@ int main(int argc, char **argv) {
                         fread(bootrom, 1, 0x100, bootrom_f);
                     }
                     break;
+                case 't':
+                    if (++i >= argc - 1) {
+                        fprintf(stderr, "No trace file specified\n%s", help);
+                        return 1;
+                    }
+                    trace_path = argv[i];
+                    break;
+                case 'B':
+                    blocks = true;
+                    break;
+                case 'J':
+                    jit = true;
+                    break;
+                case 'A':
+                    accurate = true;
+                    break;
+                case 'H':
+                    headless = true;
+                    break;
+                case 'm':
+                case 'M':
+                    if (++i >= argc - 1) {
+                        fprintf(stderr, "No movie file specified\n%s", help);
+                        return 1;
+                    }
+                    if (argv[i - 1][1] == 'm')
+                        record_path = argv[i];
+                    else
+                        play_path = argv[i];
+                    break;
+                case 'L':
+                    if (++i >= argc - 1) {
+                        fprintf(stderr, "No link socket specified\n%s", help);
+                        return 1;
+                    }
+                    link_path = argv[i];
+                    break;
+                case 'R':
+                    if (++i >= argc - 1) {
+                        fprintf(stderr, "No rewind size specified\n%s", help);
+                        return 1;
+                    }
+                    rewind_mb = strtoull(argv[i], NULL, 0);
+                    break;
+                case 'p':
+                    if (++i >= argc - 1) {
+                        fprintf(stderr, "No profile file specified\n%s", help);
+                        return 1;
+                    }
+                    profile_path = argv[i];
+                    break;
                 case 'v':
                     fprintf(stderr, "%s", PKG_VER);
                     return 0;
@@ -51,6 +129,19 @@ int main(int argc, char **argv) {
         }
     }
 
+#ifndef SM83_PROFILE
+    if (profile_path) {
+        fprintf(stderr, "Profiling needs a build with -Dprofile=true\n");
+        return 1;
+    }
+#endif
+#ifndef SM83_JIT
+    if (jit) {
+        fprintf(stderr, "The jit needs a build with -Djit=true\n");
+        return 1;
+    }
+#endif
+
     // we need read permissions if a file exists
     if (access(argv[argc - 1], F_OK | R_OK) == -1) {
         fprintf(stderr, "Unable to read rom \"%s\"", argv[argc - 1]);
@@ -58,43 +149,129 @@ int main(int argc, char **argv) {
     }
 
     // load rom
-    rom_f = fopen(argv[argc - 1], "rb");
-    fseek(rom_f, 0, SEEK_END);
-    uint32_t rom_size = ftell(rom_f);
-    rewind(rom_f);
-    rom = malloc(rom_size);
-    fread(rom, 1, rom_size, rom_f);
+    if (!rom_open(&rom, argv[argc - 1])) {
+        fprintf(stderr, "Unable to read rom \"%s\"", argv[argc - 1]);
+        return 1;
+    }
 
     sm83 cpu;
-    sm83_init(&cpu, bootrom, rom);
+    sm83_init(&cpu, bootrom, rom.data);
+    cpu.accurate = accurate;
+    if (blocks && !sm83_use_blocks(&cpu, true))
+        fprintf(stderr, "Unable to allocate the block cache, interpreting instead\n");
+#ifdef SM83_JIT
+    if (jit && !sm83_use_jit(&cpu, true, false))
+        fprintf(stderr, "Unable to set up the jit: %s, interpreting instead\n", strerror(errno));
+#endif
 
+    // battery backed ram is kept in a .sav next to the rom
+    uint8_t *sav = NULL;
+    size_t sav_size = cpu.mmu->cram_size;
+    if (cpu.mmu->mbc.battery) {
+        char path[4096];
+        const char *rom_path = argv[argc - 1], *slash = strrchr(rom_path, '/'), *dot = strrchr(rom_path, '.');
+        int stem = dot && (!slash || dot > slash) ? dot - rom_path : (int)strlen(rom_path);
+        snprintf(path, sizeof(path), "%.*s.sav", stem, rom_path);
+        if ((sav = sav_open(path, sav_size)))
+            mmu_use_cart_ram(cpu.mmu, sav);
+        else
+            fprintf(stderr, "Unable to open save file \"%s\", progress won't be kept\n", path);
+    }
 #ifdef DEBUG
-    FILE *log = fopen("log.txt", "w+"), *dump = fopen("dump.bin", "w+");
+    cpu.mmu->serial_out = serial_print;
 #endif
-    do {
-#ifdef DEBUG
-        if (cpu.mmu->mem[0xdffd] == 47)
-            break;
-        fprintf(log, "A:%02x F:%02x B:%02x C:%02x D:%02x E:%02x H:%02x L:%02x SP:%04x PC:%04x PCMEM:%02x,%02x,%02x,%02x\n",
-            cpu.af.hilo[HI], cpu.af.hilo[LO], cpu.bc.hilo[HI], cpu.bc.hilo[LO], cpu.de.hilo[HI], cpu.de.hilo[LO],
-            cpu.hl.hilo[HI], cpu.hl.hilo[LO], cpu.sp, cpu.pc, mmu_read8(cpu.mmu, cpu.pc), mmu_read8(cpu.mmu, cpu.pc + 1),
-            mmu_read8(cpu.mmu, cpu.pc + 2), mmu_read8(cpu.mmu, cpu.pc + 3));
-        fwrite(cpu.mmu->mem, 1, 0x10000, dump);
-        rewind(dump);
+
+    // movies count frames from power on, rewinding would take them out of step
+    movie play, record;
+    movie_init(&play);
+    movie_init(&record);
+    if (play_path && !movie_load(&play, play_path, rom.data)) {
+        fprintf(stderr, "Unable to play movie \"%s\", it's unreadable or for another rom\n", play_path);
+        return 1;
+    }
+    if (play_path || record_path)
+        rewind_mb = 0;
+
+    // the other end has to be running too, the first one started waits for the second
+    int link_fd = -1;
+    if (link_path) {
+        fprintf(stderr, "Waiting for the other end of the link cable on \"%s\"\n", link_path);
+        if ((link_fd = link_socket_open(link_path)) == -1) {
+            fprintf(stderr, "Unable to open link socket \"%s\": %s\n", link_path, strerror(errno));
+            return 1;
+        }
+        link_plug(cpu.mmu, true);
+        rewind_mb = 0; // the other end can't go back with it
+    }
+
+    // the ring is drained by its own thread so the emulator only pays for filling it
+    trace *tr = NULL;
+    if (trace_path) {
+        tr = malloc(sizeof(*tr));
+        if (!trace_open(tr, trace_path, true)) {
+            fprintf(stderr, "Unable to write trace \"%s\"\n", trace_path);
+            return 1;
+        }
+        cpu.trace = tr;
+    }
+
+    // the window runs it in real time, tab held down runs it uncapped, backspace rewinds,
+    // escape or closing it quits
+    int status = 0;
+    if (headless) {
+        // a movie runs to its end, the last frame's hash is what replays get compared by
+        // a linked one hangs up when it locks up, the other end carries on alone
+        for (uint64_t frame = 0; !sm83_locked_up(&cpu) && (!play_path || frame < play.frames); ++frame) {
+            uint8_t buttons = movie_input(&play, frame);
+            if (record_path && !movie_record(&record, buttons)) {
+                fprintf(stderr, "Unable to record any more input, stopping the recording\n");
+                record_path = NULL;
+            }
+            mmu_set_buttons(cpu.mmu, buttons);
+            if (link_fd == -1) {
+                sm83_run(&cpu, FRAME_CYCLES);
+            } else if (!link_socket_run(link_fd, &cpu, FRAME_CYCLES)) {
+                link_socket_close(link_fd);
+                link_fd = -1;
+            }
+        }
+        if (play_path)
+            printf("%s: %zu frames played, frame hash %016llx\n", argv[argc - 1], play.frames,
+                (unsigned long long)ppu_frame_hash(&cpu.mmu->ppu));
+    } else {
+        rewind_ring *rewind = rewind_mb ? rewind_new(&cpu, rewind_mb << 20, GUI_REWIND_FRAMES) : NULL;
+        if (rewind_mb && !rewind)
+            fprintf(stderr, "Unable to allocate the rewind history, carrying on without it\n");
+        gui_options opts = {GUI_SCALE, rewind, play_path ? &play : NULL, record_path ? &record : NULL, link_fd};
+        if (!gui_run(&cpu, PKG_NAME, &opts))
+            status = 1;
+        rewind_free(rewind);
+    }
+
+    if (record_path && !movie_save(&record, record_path, rom.data)) {
+        fprintf(stderr, "Unable to write movie \"%s\"\n", record_path);
+        status = 1;
+    }
+    movie_free(&play);
+    movie_free(&record);
+    if (link_fd != -1)
+        link_socket_close(link_fd);
+    if (tr) {
+        trace_close(tr);
+        free(tr);
+    }
+#ifdef SM83_PROFILE
+    if (profile_path && !profile_dump(cpu.prof, profile_path))
+        fprintf(stderr, "Unable to write profile \"%s\"\n", profile_path);
 #endif
-        sm83_step(&cpu);
-    } while (!cpu.halt);
 
     sm83_deinit(&cpu);
-    free(rom);
-    fclose(rom_f);
+    if (sav)
+        sav_close(sav, sav_size);
+    rom_close(&rom);
     if (bootrom) {
         free(bootrom);
         fclose(bootrom_f);
     }
-#ifdef DEBUG
-    fclose(log);
-    fclose(dump);
-#endif
-    return 0;
+    return status;
 }
@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mbc.h"
+
+// one second of the 1MHz m-cycle clock
+#define RTC_CYCLES 1048576
+#define RTC_DAYS 512
+
+static bool mbc_has_battery(uint8_t type) {
+    switch (type) {
+        case 0x03: case 0x06: case 0x09: case 0x0d: case 0x0f: case 0x10: case 0x13: case 0x1b: case 0x1e: return true;
+        default: return false;
+    }
+}
+
+static mbc_type mbc_from_header(uint8_t type) {
+    switch (type) {
+        case 0x01: case 0x02: case 0x03: return MBC_1;
+        case 0x0f: case 0x10: case 0x11: case 0x12: case 0x13: return MBC_3;
+        case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: return MBC_5;
+        default: return MBC_NONE; // rom only, and the mappers we don't do yet
+    }
+}
+
+// works out which banks are visible from the registers
+static void mbc_banks(mbc *self) {
+    uint16_t mask = self->rom_banks - 1;
+    switch (self->type) {
+        case MBC_NONE:
+            self->rom0 = 0;
+            self->romx = 1 & mask;
+            self->ram_bank = 0;
+            break;
+        case MBC_1:
+            // bank 0 can't be selected in the low bits, so 0x20/0x40/0x60 become 0x21/0x41/0x61
+            self->romx = ((self->bank_hi << 5) | (self->bank_lo ? self->bank_lo : 1)) & mask;
+            // mode 1 applies the upper bits to the first bank and ram as well
+            self->rom0 = self->mode ? (self->bank_hi << 5) & mask : 0;
+            self->ram_bank = self->mode ? self->bank_hi : 0;
+            break;
+        case MBC_3:
+            self->rom0 = 0;
+            self->romx = (self->bank_lo ? self->bank_lo : 1) & mask;
+            self->ram_bank = self->bank_hi & 3;
+            break;
+        case MBC_5:
+            self->rom0 = 0;
+            self->romx = self->bank_lo & mask; // bank 0 is allowed here
+            self->ram_bank = self->bank_hi & 0xf;
+            break;
+    }
+}
+
+void mbc_init(mbc *self, const uint8_t *rom) {
+    memset(self, 0, sizeof(*self));
+    self->type = mbc_from_header(rom[0x147]);
+    self->rom_banks = rom[0x148] <= 8 ? 2 << rom[0x148] : 2;
+    static const uint32_t ram_sizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+    self->ram_size = rom[0x149] < 6 ? ram_sizes[rom[0x149]] : 0;
+    self->battery = mbc_has_battery(rom[0x147]) && self->ram_size;
+    self->bank_lo = 1;
+    mbc_banks(self);
+}
+
+// bring the clock up to date, it counts whole seconds so the leftover cycles carry on
+static void mbc_rtc_sync(mbc *self, uint64_t now) {
+    if (!self->rtc_halt) {
+        uint64_t secs = (now - self->rtc_time) / RTC_CYCLES;
+        self->rtc_secs += secs;
+        self->rtc_time += secs * RTC_CYCLES;
+        if (self->rtc_secs >= (uint64_t)RTC_DAYS * 86400) {
+            self->rtc_secs %= (uint64_t)RTC_DAYS * 86400;
+            self->rtc_carry = true;
+        }
+    } else {
+        self->rtc_time = now;
+    }
+}
+
+static void mbc_rtc_regs(const mbc *self, uint8_t *regs) {
+    uint64_t days = self->rtc_secs / 86400;
+    regs[0] = self->rtc_secs % 60;
+    regs[1] = self->rtc_secs / 60 % 60;
+    regs[2] = self->rtc_secs / 3600 % 24;
+    regs[3] = days & 0xff;
+    regs[4] = ((days >> 8) & 1) | (self->rtc_halt << 6) | (self->rtc_carry << 7);
+}
+
+bool mbc_write(mbc *self, uint64_t now, uint16_t addr, uint8_t val) {
+    if (self->type == MBC_NONE)
+        return false;
+    bool ram_was = mbc_ram_mapped(self);
+    uint16_t rom0 = self->rom0, romx = self->romx;
+    uint8_t ram_bank = self->ram_bank;
+    switch (addr >> 13) {
+        case 0: // 0x0000-0x1fff ram (and rtc) enable
+            self->ram_enable = (val & 0xf) == 0xa;
+            break;
+        case 1: // 0x2000-0x3fff rom bank
+            if (self->type == MBC_1)
+                self->bank_lo = val & 0x1f;
+            else if (self->type == MBC_3)
+                self->bank_lo = val & 0x7f;
+            else if (addr < 0x3000)
+                self->bank_lo = (self->bank_lo & 0x100) | val;
+            else
+                self->bank_lo = (self->bank_lo & 0xff) | ((val & 1) << 8);
+            break;
+        case 2: // 0x4000-0x5fff upper rom bits, ram bank or rtc register
+            self->bank_hi = self->type == MBC_1 ? val & 3 : val & 0xf;
+            break;
+        case 3: // 0x6000-0x7fff mbc1 banking mode, mbc3 rtc latch on 0 then 1
+            if (self->type == MBC_1) {
+                self->mode = val & 1;
+            } else if (self->type == MBC_3) {
+                if (self->rtc_latch_armed && val == 1) {
+                    mbc_rtc_sync(self, now);
+                    mbc_rtc_regs(self, self->rtc_latched);
+                }
+                self->rtc_latch_armed = val == 0;
+            }
+            break;
+    }
+    mbc_banks(self);
+    return ram_was != mbc_ram_mapped(self) || rom0 != self->rom0 || romx != self->romx || ram_bank != self->ram_bank;
+}
+
+uint8_t mbc_ram_read(mbc *self) {
+    if (self->type == MBC_3 && self->ram_enable && self->bank_hi >= 0x08 && self->bank_hi <= 0x0c)
+        return self->rtc_latched[self->bank_hi - 0x08];
+    return 0xff;
+}
+
+void mbc_ram_write(mbc *self, uint64_t now, uint8_t val) {
+    if (self->type != MBC_3 || !self->ram_enable || self->bank_hi < 0x08 || self->bank_hi > 0x0c)
+        return;
+    mbc_rtc_sync(self, now);
+    uint8_t regs[5];
+    mbc_rtc_regs(self, regs);
+    uint8_t reg = self->bank_hi - 0x08;
+    regs[reg] = val;
+    if (reg == 0) // writing the seconds restarts the current second
+        self->rtc_time = now;
+    if (reg == 4) {
+        self->rtc_halt = val & 0x40;
+        self->rtc_carry = val & 0x80;
+    }
+    self->rtc_secs = regs[0] % 60 + (regs[1] % 60) * 60 + (regs[2] % 24) * 3600
+        + (uint64_t)(regs[3] | ((regs[4] & 1) << 8)) * 86400;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the memory bank controller picked from the cartridge type at 0x147, it only works out
+// bank numbers when a register is written and the bus maps those banks straight in
+typedef enum {
+    MBC_NONE,
+    MBC_1,
+    MBC_3,
+    MBC_5,
+} mbc_type;
+
+typedef struct {
+    uint8_t type;
+    uint16_t rom_banks; // 16KiB banks in the image, always a power of 2
+    uint32_t ram_size; // bytes of cart ram from header byte 0x149
+    bool battery; // the ram should outlive the process
+    // registers as written
+    bool ram_enable, mode; // mode is mbc1's banking mode
+    uint16_t bank_lo; // mbc1 5 bits, mbc3 7 bits, mbc5 9 bits
+    uint8_t bank_hi; // mbc1 upper rom/ram bits, mbc3/5 ram bank or rtc register
+    // banks currently in 0x0000-0x3fff, 0x4000-0x7fff and 0xa000-0xbfff
+    uint16_t rom0, romx;
+    uint8_t ram_bank;
+    // mbc3 clock, counted in emulated time so runs stay deterministic
+    uint64_t rtc_time; // when rtc_secs was last brought up to date
+    uint64_t rtc_secs; // seconds on the clock, days included
+    bool rtc_halt, rtc_carry, rtc_latch_armed;
+    uint8_t rtc_latched[5]; // s, m, h, dl, dh as of the last latch
+} mbc;
+
+void mbc_init(mbc *self, const uint8_t *rom);
+// handles a write to 0x0000-0x7fff, returns true if the banks or ram access changed
+bool mbc_write(mbc *self, uint64_t now, uint16_t addr, uint8_t val);
+// cart ram can be mapped straight in, otherwise it reads 0xff or an rtc register
+static inline bool mbc_ram_mapped(const mbc *self) {
+    return self->type == MBC_NONE || (self->ram_enable && !(self->type == MBC_3 && self->bank_hi >= 0x08));
+}
+// 0xa000-0xbfff accesses when the ram is not mapped
+uint8_t mbc_ram_read(mbc *self);
+void mbc_ram_write(mbc *self, uint64_t now, uint8_t val);
@@ -1,266 +1,337 @@
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
-#ifdef DEBUG
-#include <stdio.h>
-#include <unistd.h>
-#endif
-
 #include "mmu.h"
 
-void mmu_init(_mmu *self, uint8_t *bootrom, uint8_t *rom) {
+// point 'len' bytes of the address space starting at 'addr' straight at 'mem'
+static void mmu_map(const uint8_t **map, uint16_t addr, uint32_t len, const uint8_t *mem) {
+    for (uint32_t i = 0; i < len; i += PAGE_SIZE)
+        map[(addr + i) >> PAGE_SHIFT] = mem ? mem + i : NULL;
+}
+
+// the banks the mapper has selected, only redone when a bank write changes them
+static void mmu_map_banks(_mmu *self) {
+    mmu_map(self->rmap, 0x0000, 0x4000, self->rom + 0x4000 * self->mbc.rom0);
+    if (self->bootrom && !self->io[0x50]) // overlay the bootrom until 0xff50 is written
+        self->rmap[0x00] = self->bootrom;
+    mmu_map(self->rmap, 0x4000, 0x4000, self->rom + 0x4000 * self->mbc.romx);
+    // disabled or missing ram and the rtc go through the handlers, ram smaller than a bank is mirrored
+    bool ram = self->cram_size && mbc_ram_mapped(&self->mbc);
+    uint32_t base = self->mbc.ram_bank * 0x2000;
+    for (uint32_t i = 0; i < 0x2000; i += PAGE_SIZE) {
+        mem_page *page = ram ? self->cram[((base + i) % self->cram_size) >> PAGE_SHIFT] : NULL;
+        self->rmap[(0xa000 + i) >> PAGE_SHIFT] = page ? page->data : NULL;
+        self->wmap[(0xa000 + i) >> PAGE_SHIFT] = page && !page_shared(page) ? page->data : NULL;
+    }
+}
+
+// vram pages, tile data writes always go through the tile cache
+static void mmu_map_vram_page(_mmu *self, uint8_t page) {
+    mem_page *mem = self->ppu.vram[page];
+    self->rmap[(0x8000 >> PAGE_SHIFT) + page] = mem->data;
+    self->wmap[(0x8000 >> PAGE_SHIFT) + page] = page >= 0x1800 >> PAGE_SHIFT && !page_shared(mem) ? mem->data : NULL;
+}
+
+// a wram page and its echo, only writable while no fork shares it and no decoded code is watching it
+static void mmu_map_wram_page(_mmu *self, uint8_t page) {
+    mem_page *mem = self->wram[page];
+    uint8_t *w = (self->code_pages & (1u << page)) || page_shared(mem) ? NULL : mem->data;
+    self->rmap[(0xc000 >> PAGE_SHIFT) + page] = mem->data;
+    self->wmap[(0xc000 >> PAGE_SHIFT) + page] = w;
+    if (page < 0x1e00 >> PAGE_SHIFT) { // echo ram
+        self->rmap[(0xe000 >> PAGE_SHIFT) + page] = mem->data;
+        self->wmap[(0xe000 >> PAGE_SHIFT) + page] = w;
+    }
+}
+
+void mmu_remap(_mmu *self) {
+    memset(self->rmap, 0, sizeof(self->rmap));
+    memset(self->wmap, 0, sizeof(self->wmap));
+    mmu_map_banks(self);
+
+    // wram may hold anything now, so any code decoded from it is stale
+    self->code_pages = 0;
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i)
+        ++self->code_gen[i];
+    // everything else that is plain memory can be accessed without the handlers
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i) {
+        mmu_map_vram_page(self, i);
+        mmu_map_wram_page(self, i);
+    }
+}
+
+void mmu_watch_code(_mmu *self, uint16_t addr) {
+    uint8_t page = (addr & 0x1fff) >> PAGE_SHIFT;
+    self->code_pages |= 1u << page;
+    mmu_map_wram_page(self, page);
+}
+
+void mmu_init(_mmu *self, const uint8_t *bootrom, const uint8_t *rom) {
+    memset(self, 0, sizeof(*self));
     self->rom = rom;
-    self->rombank = self->rom[0x148];
-    if (bootrom) { // load bootrom_ptr over the rom and unmap later
-        memcpy(self->mem, self->rom, 0x100); // copy back from ram later since rom isn't read there lol
+    self->bootrom = bootrom;
+    mbc_init(&self->mbc, rom);
+    self->cram_size = self->mbc.ram_size;
+    if (self->cram_size) {
+        self->cram = malloc((self->cram_size >> PAGE_SHIFT) * sizeof(*self->cram));
+        for (uint32_t i = 0; i < self->cram_size >> PAGE_SHIFT; ++i)
+            self->cram[i] = page_new(NULL);
+    }
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i)
+        self->wram[i] = page_new(NULL);
+    sched_init(&self->sched);
+    timer_init(&self->timer, &self->sched);
+    joypad_init(&self->joypad);
+    ppu_init(&self->ppu, &self->sched);
+    apu_init(&self->apu, &self->sched);
+    mmu_remap(self);
+
+    if (!bootrom) { // emulate state after bootrom
+        ppu_write(&self->ppu, &self->sched, 0xff40, 0x91);
+        ppu_write(&self->ppu, &self->sched, 0xff47, 0xfc);
+        joypad_write(&self->joypad, 0x00); // reads 0xcf
+        apu_write(&self->apu, &self->sched, 0xff26, 0x80);
+        apu_write(&self->apu, &self->sched, 0xff11, 0xbf);
+        apu_write(&self->apu, &self->sched, 0xff12, 0xf3);
+        apu_write(&self->apu, &self->sched, 0xff25, 0xf3);
+        apu_write(&self->apu, &self->sched, 0xff24, 0x77);
+        self->apu.ch[0].on = true; // the boot sound has died away but square 1 is still on
+        self->io[0x0f] = INT_VBLANK;
     }
 }
 
-#ifdef DEBUG
-void debug_addr_printer(_mmu *self, uint16_t addr, uint8_t val, char rw) {
-    if (addr == 0xdef6) {
-        if (rw == 'r') {
-            printf("rd %02x<-%04x by %02x\n",
-                self->mem[addr], addr, self->opcode);
-        } else {
-            printf("wt %02x->%04x by %02x\n",
-                val, addr, self->opcode);
+void mmu_deinit(_mmu *self) {
+    apu_deinit(&self->apu);
+    ppu_deinit(&self->ppu);
+    for (uint32_t i = 0; i < self->cram_size >> PAGE_SHIFT; ++i)
+        page_unref(self->cram[i]);
+    free(self->cram);
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i)
+        page_unref(self->wram[i]);
+}
+
+void mmu_use_cart_ram(_mmu *self, uint8_t *mem) {
+    for (uint32_t i = 0; i < self->cram_size >> PAGE_SHIFT; ++i) {
+        page_unref(self->cram[i]);
+        self->cram[i] = page_new(mem + i * PAGE_SIZE);
+    }
+    mmu_remap(self);
+}
+
+void mmu_fork(_mmu *self, _mmu *parent) {
+    *self = *parent;
+    self->apu.out = NULL;
+    self->serial_out = NULL;
+    self->serial_ctx = NULL;
+    self->link = (serial_port){0}; // the cable stays with the parent
+    if (self->cram_size) {
+        self->cram = malloc((self->cram_size >> PAGE_SHIFT) * sizeof(*self->cram));
+        for (uint32_t i = 0; i < self->cram_size >> PAGE_SHIFT; ++i)
+            self->cram[i] = page_fork(parent->cram[i]);
+    }
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i) {
+        self->wram[i] = page_fork(parent->wram[i]);
+        self->ppu.vram[i] = page_fork(parent->ppu.vram[i]);
+    }
+    // both lose their write mappings to what they now share
+    mmu_remap(parent);
+    mmu_remap(self);
+}
+
+void mmu_events(_mmu *self) {
+    int ev;
+    while ((ev = sched_pop(&self->sched)) >= 0) {
+        switch (ev) {
+            case EV_TIMER: self->io[0x0f] |= timer_event(&self->timer, &self->sched); break;
+            case EV_PPU: self->io[0x0f] |= ppu_event(&self->ppu, &self->sched); break;
+            case EV_SERIAL: // either clock's transfer finishing
+                self->io[0x01] = self->serial_in;
+                self->io[0x02] &= 0x7f;
+                self->io[0x0f] |= INT_SERIAL;
+                break;
         }
     }
 }
-#endif
 
-uint8_t mmu_read8(_mmu *self, uint16_t addr) {
-#ifdef DEBUG
-    debug_addr_printer(self, addr, 0, 'r');
-#endif
-    switch (addr & 0xf000) {
-        case 0x0000:
-            // rom bank 00
-            return self->rom[addr];
-            break;
-        case 0x4000:
-            // rom bank 01-nn via mapper
-            return self->rom[addr + (0x4000 * (self->rombank))];
-            break;
-        case 0x8000:
-            // vram
-            break;
-        case 0xa000:
-            // external ram, no need to worry about enabling
-            return self->mem[addr - 0x8000];
-            break;
-        case 0xc000:
-            // wram
-            return self->mem[addr - 0x8000];
-            break;
-        case 0xd000:
-            // wram, cgb can switch banks
-            return self->mem[addr - 0x8000];
-            break;
-        case 0xe000:
-        echoram:
-            return self->mem[addr - 0x9000];
-            break;
-        case 0xf000:
-            if (addr < 0xfe00)
-                goto echoram;
-            else if (addr < 0xfea0) {
-                // oam
-            } else if (addr < 0xff00) {
-                // not useable
-            } else if (addr < 0xff80) {
-                // io registers excluding the cgb ones
-                if (addr == 0xff00) {
-                    // pad input
-                } else if (addr == 0xff01) {
-                    // serial transfer
-                    return self->mem[0xff01];
-                } else if (addr == 0xff02) {
-                    return self->mem[0xff02];
-#ifdef DEBUG // print contents of serial port to terminal
-                    fprintf(stderr, "%c", self->mem[addr]);
-#endif
-                } else if (addr == 0xff04) {
-                    // divider register, incremented at 16384Hz/every 256 cycles
-                    return self->mem[0xff04];
-                } else if (addr == 0xff05) {
-                    // timer counter
-                } else if (addr == 0xff06) {
-                    // timer modulo
-                } else if (addr == 0xff07) {
-                    // timer control
-                } else if (addr == 0xff0f) {
-                    // interrupt flag
-                } else if (addr < 0xff27 && addr > 0xff09) {
-                    // audio
-                } else if (addr < 0xff40 && addr > 0xff29) {
-                    // wave pattern
-                } else if (addr == 0xff40) {
-                    // lcd control
-                } else if (addr == 0xff41) {
-                    // lcd status
-                } else if (addr == 0xff42) {
-                    // viewport y pos
-                } else if (addr == 0xff43) {
-                    // viewport x pos
-                } else if (addr == 0xff44) {
-                    return 0x90;
-                    // lcd y co ordinate
-                } else if (addr == 0xff45) {
-                    // lcd y compare
-                } else if (addr == 0xff46) {
-                    // oam dma source addr and start
-                } else if (addr == 0xff47) {
-                    // bg colour palette
-                } else if (addr == 0xff48) {
-                    // obj palette 0 data
-                } else if (addr == 0xff49) {
-                    // obj palette 1 data
-                } else if (addr == 0xff4a) {
-                    // window y pos
-                } else if (addr == 0xff4b) {
-                    // window x pos + 7
-                } else if (addr == 0xff50) {
-                    // i don't know what happens if you read here, time to guess!!
-                    return 0xff;
-                }
-            } else if (addr < 0xffff) {
-                return self->mem[addr];
-                // hram
-            } else if (addr == 0xffff) {
-                // interrupt enable register
-            } else {
-#ifdef DEBUG
-                fprintf(stderr, "warning: unrecognised i/o port \"%04x\" read", addr);
-#endif
+uint8_t mmu_read8_slow(_mmu *self, uint16_t addr) {
+    if (addr >= 0xa000 && addr < 0xc000) {
+        // cart ram while it is disabled or the rtc is selected
+        return mbc_ram_read(&self->mbc);
+    } else if (addr < 0xfe00) {
+        // every other page below here is mapped
+        return 0xff;
+    } else if (addr < 0xfea0) {
+        // oam
+        return self->ppu.oam[addr - 0xfe00];
+    } else if (addr < 0xff00) {
+        // not useable
+        return 0xff;
+    } else if (addr >= 0xff10 && addr < 0xff40) {
+        // audio and wave pattern ram
+        return apu_read(&self->apu, &self->sched, addr);
+    } else if (addr < 0xff80) {
+        // io registers excluding the cgb ones
+        switch (addr) {
+            case 0xff00: // pad input
+                return joypad_read(&self->joypad);
+            case 0xff01: // serial transfer
+                return self->io[0x01];
+            case 0xff02:
+                return self->io[0x02] | 0x7e;
+            case 0xff04: // divider register
+            case 0xff05: // timer counter
+            case 0xff06: // timer modulo
+            case 0xff07: // timer control
+                return timer_read(&self->timer, &self->sched, addr);
+            case 0xff0f: // interrupt flag
+                return self->io[0x0f] | 0xe0;
+            case 0xff40: // lcd control
+            case 0xff41: // lcd status
+            case 0xff42: // viewport y pos
+            case 0xff43: // viewport x pos
+            case 0xff44: // lcd y co ordinate
+            case 0xff45: // lcd y compare
+            case 0xff47: // bg colour palette
+            case 0xff48: // obj palette 0 data
+            case 0xff49: // obj palette 1 data
+            case 0xff4a: // window y pos
+            case 0xff4b: // window x pos + 7
+                return ppu_read(&self->ppu, &self->sched, addr);
+            case 0xff46: // oam dma source addr and start
+                return self->io[0x46];
+            case 0xff50: // i don't know what happens if you read here, time to guess!!
                 return 0xff;
-            }
-            break;
-        default:
-            return 0xff;
+            default:
+                break;
+        }
+        return 0xff;
+    } else {
+        // hram and the interrupt enable register
+        return self->hram[addr - 0xff80];
     }
 }
 
-void mmu_write8(_mmu *self, uint16_t addr, uint8_t val) {
-#ifdef DEBUG
-    debug_addr_printer(self, addr, val, 'w');
-#endif
-    switch (addr & 0xf000) {
-        case 0x0000:
-            // rom bank number, get max bank from cartridge header to mask
-            if (addr >= 0x2000)
-                self->rombank = val & 0x1f & (2 << self->rom[0x148]);
-            break;
-        case 0x4000:
-            // rom bank 01-nn via mapper
-            if (addr < 0x6000)
-                self->rombank = val & 0x1f & (2 << self->rom[0x148]);
-            break;
-        case 0x8000:
-            // vram
-            break;
-        case 0xa000:
-            // external ram
-            break;
-        case 0xc000:
-            self->mem[addr - 0x8000] = val;
-            // wram
-            break;
-        case 0xd000:
-            self->mem[addr - 0x8000] = val;
-            // wram, cgb can switch banks
-            break;
-        case 0xe000:
-        echoram:
-            self->mem[addr - 0x9000] = val;
-            break;
-        case 0xf000:
-            if (addr < 0xfe00)
-                goto echoram;
-            else if (addr < 0xfea0) {
-                // oam
-            } else if (addr < 0xff00) {
-                // not useable
-            } else if (addr < 0xff80) {
-                // io registers excluding the cgb ones
-                if (addr == 0xff00) {
-                    // pad input
-                } else if (addr == 0xff01) {
-                    // serial transfer
-                    self->mem[0xff01] = val;
-                } else if (addr == 0xff02) {
-#ifdef DEBUG // print contents of serial port to terminal
-                    fprintf(stderr, "%c", val);
-#endif
-                    self->mem[addr] = val;
-                } else if (addr == 0xff04) {
-                    // divider register, writing clears
-                    self->mem[addr] = 0;
-                } else if (addr == 0xff05) {
-                    // timer counter
-                } else if (addr == 0xff06) {
-                    // timer modulo
-                } else if (addr == 0xff07) {
-                    // timer control
-                } else if (addr == 0xff0f) {
-                    // interrupt flag
-                } else if (addr < 0xff27 && addr > 0xff09) {
-                    // audio
-                } else if (addr < 0xff40 && addr > 0xff29) {
-                    // wave pattern
-                } else if (addr == 0xff40) {
-                    // lcd control
-                } else if (addr == 0xff41) {
-                    // lcd status
-                } else if (addr == 0xff42) {
-                    // viewport y pos
-                } else if (addr == 0xff43) {
-                    // viewport x pos
-                } else if (addr == 0xff44) {
-                    // lcd y co ordinate
-                } else if (addr == 0xff45) {
-                    // lcd y compare
-                } else if (addr == 0xff46) {
-                    // oam dma source addr and start
-                } else if (addr == 0xff47) {
-                    // bg colour palette
-                } else if (addr == 0xff48) {
-                    // obj palette 0 data
-                } else if (addr == 0xff49) {
-                    // obj palette 1 data
-                } else if (addr == 0xff4a) {
-                    // window y pos
-                } else if (addr == 0xff4b) {
-                    // window x pos + 7
-                } else if (addr == 0xff50) {
-                    // set to non 0 to unmap boot rom
-                    if (val > 0) {
-                        memcpy(self->rom, self->mem, 0x100);
-                    }
-                }
-            } else if (addr < 0xffff) {
-                self->mem[addr] = val;
-                // hram
-            } else if (addr == 0xffff) {
-                // interrupt enable register
-            } else {
-#ifdef DEBUG
-                fprintf(stderr, "warning: unrecognised i/o port \"%04x\" write", addr);
-#endif
-            }
-            break;
-        default:
-            break;
+// requests interrupts from a register write, the cpu stops at the next instruction so
+// they are taken at the same point whatever else happens to end its run
+static void mmu_raise(_mmu *self, uint8_t irq) {
+    if (irq) {
+        self->io[0x0f] |= irq;
+        sched_kick(&self->sched);
     }
 }
 
-// this is done in little endian
-inline uint16_t mmu_read16(_mmu *self, uint16_t addr) {
-    return (mmu_read8(self, addr + 1) << 8) | mmu_read8(self, addr);
+void mmu_set_buttons(_mmu *self, uint8_t buttons) {
+    mmu_raise(self, joypad_set(&self->joypad, buttons));
 }
 
-inline void mmu_write16(_mmu *self, uint16_t addr, uint16_t val) {
-    mmu_write8(self, addr, val & 0xff); // write lo to address
-    mmu_write8(self, addr + 1, (val & 0xff00) >> 8); // write hi to address + 1
+void mmu_write8_slow(_mmu *self, uint16_t addr, uint8_t val) {
+    if (addr < 0x8000) {
+        // mapper registers
+        if (mbc_write(&self->mbc, self->sched.now, addr, val)) {
+            mmu_map_banks(self);
+            sched_kick(&self->sched); // the code that is running may have been switched out
+        }
+    } else if (addr < 0xa000) {
+        // vram tile data, or a page shared with a fork
+        uint8_t page = (addr - 0x8000) >> PAGE_SHIFT;
+        if (page_shared(self->ppu.vram[page])) {
+            page_own(&self->ppu.vram[page]);
+            mmu_map_vram_page(self, page);
+        }
+        ppu_vram_write(&self->ppu, addr, val);
+    } else if (addr < 0xc000) {
+        if (self->rmap[addr >> PAGE_SHIFT]) { // cart ram shared with a fork
+            mem_page **slot = &self->cram[((self->mbc.ram_bank * 0x2000 + addr - 0xa000) % self->cram_size) >> PAGE_SHIFT];
+            page_own(slot)->data[addr & (PAGE_SIZE - 1)] = val;
+            mmu_map_banks(self);
+        } else { // cart ram while it is disabled or the rtc is selected
+            mbc_ram_write(&self->mbc, self->sched.now, val);
+        }
+    } else if (addr < 0xfe00) {
+        // wram with decoded code in it or shared with a fork, every other page below here is mapped
+        uint8_t page = (addr & 0x1fff) >> PAGE_SHIFT;
+        page_own(&self->wram[page])->data[addr & (PAGE_SIZE - 1)] = val;
+        if (self->code_pages & (1u << page)) {
+            self->code_pages &= ~(1u << page);
+            ++self->code_gen[page];
+            sched_kick(&self->sched); // the running block may be the one that changed
+        }
+        mmu_map_wram_page(self, page);
+    } else if (addr < 0xfea0) {
+        // oam
+        self->ppu.oam[addr - 0xfe00] = val;
+    } else if (addr < 0xff00) {
+        // not useable
+    } else if (addr >= 0xff10 && addr < 0xff40) {
+        // audio and wave pattern ram
+        apu_write(&self->apu, &self->sched, addr, val);
+    } else if (addr < 0xff80) {
+        // io registers excluding the cgb ones
+        switch (addr) {
+            case 0xff00: // pad input
+                mmu_raise(self, joypad_write(&self->joypad, val));
+                break;
+            case 0xff01: // serial transfer
+                self->io[0x01] = val;
+                break;
+            case 0xff02:
+                self->io[0x02] = val;
+                if ((val & 0x81) == 0x81) { // internal clock transfer start, 8 bits at 8192Hz
+                    if (self->serial_out)
+                        self->serial_out(self->serial_ctx, self->io[0x01]);
+                    self->serial_in = 0xff; // nothing answers unless a cable is plugged in
+                    if (self->link.plugged) {
+                        self->link.sent = true;
+                        self->link.sent_time = self->sched.now;
+                        self->link.sent_byte = self->io[0x01];
+                    }
+                    sched_set(&self->sched, EV_SERIAL, self->sched.now + SERIAL_CYCLES);
+                }
+                break;
+            case 0xff04: // divider register, writing clears
+            case 0xff05: // timer counter
+            case 0xff06: // timer modulo
+            case 0xff07: // timer control
+                mmu_raise(self, timer_write(&self->timer, &self->sched, addr, val));
+                break;
+            case 0xff0f: // interrupt flag
+                self->io[0x0f] = val & 0x1f;
+                sched_kick(&self->sched);
+                break;
+            case 0xff40: // lcd control
+            case 0xff41: // lcd status
+            case 0xff42: // viewport y pos
+            case 0xff43: // viewport x pos
+            case 0xff44: // lcd y co ordinate
+            case 0xff45: // lcd y compare
+            case 0xff47: // bg colour palette
+            case 0xff48: // obj palette 0 data
+            case 0xff49: // obj palette 1 data
+            case 0xff4a: // window y pos
+            case 0xff4b: // window x pos + 7
+                mmu_raise(self, ppu_write(&self->ppu, &self->sched, addr, val));
+                break;
+            case 0xff46: // oam dma source addr and start
+                // copied all at once, the 160 m-cycles of bus lockout are not emulated
+                self->io[0x46] = val;
+                for (uint16_t i = 0; i < sizeof(self->ppu.oam); ++i)
+                    self->ppu.oam[i] = mmu_read8(self, (val << 8) + i);
+                break;
+            case 0xff50: // set to non 0 to unmap boot rom, for good
+                if (val > 0 && !self->io[0x50]) {
+                    self->io[0x50] = 1;
+                    mmu_map_banks(self);
+                }
+                break;
+            default:
+                break;
+        }
+    } else {
+        // hram and the interrupt enable register
+        self->hram[addr - 0xff80] = val;
+        if (addr == 0xffff)
+            sched_kick(&self->sched);
+    }
 }
@@ -1,19 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef struct { // we will likely need mappers here as well
-    uint8_t mem[0x2000]; // 0x10000 in spirit but 0x8000 is rom so wasted space
-    uint8_t rombank;
-    uint8_t *rom;
-#ifdef DEBUG
-    uint8_t opcode;
-#endif
+#include "apu.h"
+#include "joypad.h"
+#include "mbc.h"
+#include "page.h"
+#include "ppu.h"
+#include "sched.h"
+#include "timer.h"
+
+// each page of the address space either points straight at its backing storage or is NULL
+// and goes through the slow handlers, which is also where shared ram pages get copied
+#define PAGE_COUNT (0x10000 >> PAGE_SHIFT)
+
+// m-cycles to shift a byte out on the internal clock
+#define SERIAL_CYCLES 1024
+
+// interrupt flag/enable bits
+#define INT_VBLANK 0x01
+#define INT_STAT 0x02
+#define INT_TIMER 0x04
+#define INT_SERIAL 0x08
+#define INT_JOYPAD 0x10
+
+// this end of a link cable, which only gets looked at between slices, see link.h
+typedef struct {
+    bool plugged;
+    bool sent; // a transfer was clocked out since the last exchange
+    uint64_t sent_time;
+    uint8_t sent_byte;
+} serial_port;
+
+typedef struct {
+    const uint8_t *rmap[PAGE_COUNT]; // the rom is mapped read only, nothing may write through these
+    uint8_t *wmap[PAGE_COUNT];
+    mem_page **cram; // cart ram, banked by the mapper, cram_size >> PAGE_SHIFT pages
+    uint32_t cram_size;
+    mem_page *wram[0x2000 >> PAGE_SHIFT];
+    uint8_t io[0x80];
+    uint8_t hram[0x80]; // the last byte is the interrupt enable register
+    mbc mbc;
+    const uint8_t *rom, *bootrom; // never written, the bootrom is only an overlay in the page tables
+    // the clock lives on the bus so i/o registers can be derived from it,
+    // the cpu returns from its inner loop whenever an event is due
+    sched sched;
+    timer timer;
+    ppu ppu;
+    apu apu;
+    joypad joypad;
+    // wram pages the block cache has decoded code from lose their write mapping,
+    // a write to one bumps its generation so those blocks get decoded again
+    uint32_t code_pages; // one bit per page
+    uint32_t code_gen[0x2000 >> PAGE_SHIFT];
+    // gets every byte the rom sends out over the serial port, may be NULL
+    void (*serial_out)(void *ctx, uint8_t byte);
+    void *serial_ctx;
+    uint8_t serial_in; // what the transfer in progress shifts in, 1s unless the other end answers
+    serial_port link;
 } _mmu;
 
-void mmu_init(_mmu *self, uint8_t *bootrom_ptr, uint8_t *romptr);
+void mmu_init(_mmu *self, const uint8_t *bootrom_ptr, const uint8_t *romptr);
+void mmu_deinit(_mmu *self);
+// swaps the cart ram for caller owned memory of mbc.ram_size bytes, which has to outlive the instance
+void mmu_use_cart_ram(_mmu *self, uint8_t *mem);
+// makes 'self' a copy of 'parent' that runs on its own from here. the ram is shared between
+// them and only copied a page at a time as either side writes to it, so forks are cheap
+// and many of them fit in memory. the parent's serial and audio outputs and its link cable
+// aren't carried over
+void mmu_fork(_mmu *self, _mmu *parent);
+// rebuilds the page tables from the banking state, e.g. after loading a save state
+void mmu_remap(_mmu *self);
+// the buttons held from now on, JOYPAD_* bits. set between runs, e.g. once a frame
+void mmu_set_buttons(_mmu *self, uint8_t buttons);
+// handles every event that is due
+void mmu_events(_mmu *self);
+// catches writes to the wram page holding 'addr' (or its echo) until its generation changes
+void mmu_watch_code(_mmu *self, uint16_t addr);
+
+// i/o, oam and mapper registers, only called when the page has no mapping
+uint8_t mmu_read8_slow(_mmu *self, uint16_t addr);
+void mmu_write8_slow(_mmu *self, uint16_t addr, uint8_t val);
 
-uint8_t mmu_read8(_mmu *self, uint16_t addr);
-void mmu_write8(_mmu *self, uint16_t addr, uint8_t val);
+static inline uint8_t mmu_read8(_mmu *self, uint16_t addr) {
+    const uint8_t *page = self->rmap[addr >> PAGE_SHIFT];
+    if (page)
+        return page[addr & (PAGE_SIZE - 1)];
+    return mmu_read8_slow(self, addr);
+}
+
+static inline void mmu_write8(_mmu *self, uint16_t addr, uint8_t val) {
+    uint8_t *page = self->wmap[addr >> PAGE_SHIFT];
+    if (page)
+        page[addr & (PAGE_SIZE - 1)] = val;
+    else
+        mmu_write8_slow(self, addr, val);
+}
 
 // this is done in little endian
-uint16_t mmu_read16(_mmu *self, uint16_t addr);
-void mmu_write16(_mmu *self, uint16_t addr, uint16_t val);
+static inline uint16_t mmu_read16(_mmu *self, uint16_t addr) {
+    return mmu_read8(self, addr) | (mmu_read8(self, addr + 1) << 8);
+}
+
+static inline void mmu_write16(_mmu *self, uint16_t addr, uint16_t val) {
+    mmu_write8(self, addr, val & 0xff); // write lo to address
+    mmu_write8(self, addr + 1, (val & 0xff00) >> 8); // write hi to address + 1
+}
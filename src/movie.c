@@ -0,0 +1,69 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+
+// the rom is told apart by its header and global checksums
+static void movie_header(const uint8_t *rom, uint8_t *out) {
+    memcpy(out, MOVIE_MAGIC, 4);
+    out[4] = MOVIE_VERSION;
+    memcpy(out + 5, &rom[0x14d], 3);
+}
+
+void movie_init(movie *self) {
+    self->inputs = NULL;
+    self->frames = 0;
+    self->cap = 0;
+}
+
+void movie_free(movie *self) {
+    free(self->inputs);
+    movie_init(self);
+}
+
+bool movie_load(movie *self, const char *path, const uint8_t *rom) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    uint8_t header[MOVIE_HEADER_SIZE], want[MOVIE_HEADER_SIZE];
+    movie_header(rom, want);
+    bool ok = fread(header, 1, MOVIE_HEADER_SIZE, f) == MOVIE_HEADER_SIZE && !memcmp(header, want, MOVIE_HEADER_SIZE);
+    uint8_t buf[4096];
+    size_t n;
+    while (ok && (n = fread(buf, 1, sizeof(buf), f)))
+        for (size_t i = 0; ok && i < n; ++i)
+            ok = movie_record(self, buf[i]);
+    ok = ok && !ferror(f);
+    fclose(f);
+    if (!ok)
+        movie_free(self);
+    return ok;
+}
+
+bool movie_save(const movie *self, const char *path, const uint8_t *rom) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+    uint8_t header[MOVIE_HEADER_SIZE];
+    movie_header(rom, header);
+    bool ok = fwrite(header, 1, MOVIE_HEADER_SIZE, f) == MOVIE_HEADER_SIZE &&
+              fwrite(self->inputs, 1, self->frames, f) == self->frames;
+    return !fclose(f) && ok;
+}
+
+bool movie_record(movie *self, uint8_t buttons) {
+    if (self->frames == self->cap) {
+        size_t cap = self->cap ? self->cap * 2 : 4096;
+        uint8_t *inputs = realloc(self->inputs, cap);
+        if (!inputs)
+            return false;
+        self->inputs = inputs;
+        self->cap = cap;
+    }
+    self->inputs[self->frames++] = buttons;
+    return true;
+}
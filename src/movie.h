@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// a movie file is this header followed by the JOYPAD_* buttons held in each frame, a byte each
+#define MOVIE_MAGIC "GBMV"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 8
+
+// a frame is one sm83_run of FRAME_CYCLES from power on with the buttons set just before it,
+// so playing it back the same way gives the same machine at every frame on any host. it
+// only holds for the same rom, engine (-A or not) and starting cart ram
+typedef struct {
+    uint8_t *inputs;
+    size_t frames, cap;
+} movie;
+
+void movie_init(movie *self);
+void movie_free(movie *self);
+// returns false if it can't be read or was recorded on another rom
+bool movie_load(movie *self, const char *path, const uint8_t *rom);
+bool movie_save(const movie *self, const char *path, const uint8_t *rom);
+// adds a frame, returns false if there's no memory for it
+bool movie_record(movie *self, uint8_t buttons);
+
+// what's held in 'frame', nothing once the movie is over
+static inline uint8_t movie_input(const movie *self, uint64_t frame) {
+    return frame < self->frames ? self->inputs[frame] : 0;
+}
@@ -0,0 +1,44 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "page.h"
+
+mem_page *page_new(uint8_t *ext) {
+    mem_page *self = ext ? malloc(sizeof(*self)) : calloc(1, sizeof(*self));
+    atomic_init(&self->refs, 1);
+    self->data = ext ? ext : self->mem;
+    return self;
+}
+
+// the last reference frees it, whichever instance or thread that is
+void page_unref(mem_page *self) {
+    if (atomic_fetch_sub_explicit(&self->refs, 1, memory_order_acq_rel) == 1)
+        free(self);
+}
+
+static mem_page *page_copy(const mem_page *self) {
+    mem_page *copy = malloc(sizeof(*copy));
+    atomic_init(&copy->refs, 1);
+    copy->data = copy->mem;
+    memcpy(copy->mem, self->data, PAGE_SIZE);
+    return copy;
+}
+
+mem_page *page_fork(mem_page *self) {
+    if (self->data != self->mem) // nobody else may write to the caller's memory
+        return page_copy(self);
+    atomic_fetch_add_explicit(&self->refs, 1, memory_order_relaxed);
+    return self;
+}
+
+mem_page *page_own(mem_page **slot) {
+    mem_page *page = *slot;
+    if (page_shared(page)) {
+        // copied before letting go so the other side can't free it under us
+        *slot = page_copy(page);
+        page_unref(page);
+    }
+    return *slot;
+}
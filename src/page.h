@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// the address space and the ram behind it are handled in 256 byte pages
+#define PAGE_SHIFT 8
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+
+// a page of ram that forks share until one of them writes to it. 'data' is 'mem' unless
+// the page wraps caller owned memory (a mapped .sav), which is copied rather than shared
+typedef struct {
+    _Atomic uint32_t refs;
+    uint8_t *data;
+    uint8_t mem[PAGE_SIZE];
+} mem_page;
+
+// a zeroed page, or one over PAGE_SIZE bytes at 'ext' if that isn't NULL
+mem_page *page_new(uint8_t *ext);
+void page_unref(mem_page *self);
+// the page a fork gets, the same one with another reference or a copy of caller owned memory
+mem_page *page_fork(mem_page *self);
+// copies '*slot' if anyone else has a reference to it so it can be written, returns the page
+mem_page *page_own(mem_page **slot);
+
+// pages are only mapped for writing while nobody else has them
+static inline bool page_shared(mem_page *self) {
+    return atomic_load_explicit(&self->refs, memory_order_acquire) > 1;
+}
@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mmu.h"
+#include "ppu.h"
+#include "tiles.h"
+
+#define FRAME_POS_CYCLES (LINES * LINE_CYCLES)
+#define HBLANK_DOT (MODE2_CYCLES + MODE3_CYCLES)
+
+static inline bool ppu_on(ppu *self) {
+    return self->lcdc & 0x80;
+}
+
+// m-cycles since the start of the current frame
+static inline uint32_t ppu_frame_pos(ppu *self, uint64_t t) {
+    return (t - self->lcd_start) % FRAME_POS_CYCLES;
+}
+
+static uint8_t ppu_mode(uint32_t pos) {
+    uint32_t ly = pos / LINE_CYCLES, dot = pos % LINE_CYCLES;
+    if (ly >= VISIBLE_LINES)
+        return 1;
+    if (dot < MODE2_CYCLES)
+        return 2;
+    if (dot < HBLANK_DOT)
+        return 3;
+    return 0;
+}
+
+// interrupts requested at exactly this point of the frame
+static uint8_t ppu_irqs_at(ppu *self, uint32_t pos) {
+    uint32_t ly = pos / LINE_CYCLES, dot = pos % LINE_CYCLES;
+    uint8_t irq = 0;
+    if (ly == VISIBLE_LINES && dot == 0) {
+        irq |= INT_VBLANK;
+        if (self->stat & 0x10)
+            irq |= INT_STAT;
+    } else if (ly < VISIBLE_LINES) {
+        if (dot == 0 && (self->stat & 0x20))
+            irq |= INT_STAT;
+        if (dot == HBLANK_DOT && (self->stat & 0x08))
+            irq |= INT_STAT;
+    }
+    if (dot == 0 && ly == self->lyc && (self->stat & 0x40))
+        irq |= INT_STAT;
+    return irq;
+}
+
+// rendering a line at the end of mode 3 and starting vblank always need an event
+static inline bool ppu_needs_event(ppu *self, uint32_t pos) {
+    uint32_t ly = pos / LINE_CYCLES, dot = pos % LINE_CYCLES;
+    if (ly < VISIBLE_LINES ? dot == HBLANK_DOT : (ly == VISIBLE_LINES && dot == 0))
+        return true;
+    return ppu_irqs_at(self, pos);
+}
+
+// schedule the first point after 'from' that renders or requests an interrupt,
+// that is never more than a line away while the lcd is on
+static void ppu_schedule(ppu *self, sched *sched, uint64_t from) {
+    if (!ppu_on(self)) {
+        sched_cancel(sched, EV_PPU);
+        return;
+    }
+    uint32_t pos = ppu_frame_pos(self, from);
+    uint64_t frame = from - pos;
+    for (uint32_t line = pos - pos % LINE_CYCLES;; line += LINE_CYCLES) {
+        const uint32_t dots[2] = {0, HBLANK_DOT};
+        for (int i = 0; i < 2; ++i) {
+            uint32_t p = line + dots[i];
+            if (p > pos && ppu_needs_event(self, p % FRAME_POS_CYCLES)) {
+                self->event_time = frame + p;
+                sched_set(sched, EV_PPU, self->event_time);
+                return;
+            }
+        }
+    }
+}
+
+// tile numbers 0-383 counting from 0x8000, lcdc bit 4 picks between
+// unsigned from 0x8000 and signed from 0x9000 for the background and window
+static inline uint16_t ppu_bg_tile(ppu *self, uint8_t idx) {
+    return (self->lcdc & 0x10) || idx >= 0x80 ? idx : 0x100 + idx;
+}
+
+// expands one row of a 2bpp tile into colour indices
+static inline void ppu_tile_row(ppu *self, uint16_t tile, uint8_t row, uint8_t *out) {
+    if (self->tile_cache) {
+        if (self->tile_dirty[tile]) {
+            tiles_decode(self->tiles[tile], ppu_vram(self, tile * 16));
+            self->tile_dirty[tile] = false;
+        }
+        memcpy(out, &self->tiles[tile][row * 8], 8);
+        return;
+    }
+    const uint8_t *data = ppu_vram(self, tile * 16 + row * 2);
+    uint8_t lo = data[0], hi = data[1];
+    for (int i = 0; i < 8; ++i)
+        out[i] = ((lo >> (7 - i)) & 1) | (((hi >> (7 - i)) & 1) << 1);
+}
+
+static void ppu_render_sprites(ppu *self, uint8_t ly, const uint8_t *bg) {
+    uint8_t height = (self->lcdc & 0x04) ? 16 : 8, count = 0;
+    const uint8_t *objs[10];
+    // the first 10 objects on the line in oam order, then sorted by x so the
+    // lowest x wins and ties go to the earlier entry
+    for (int i = 0; i < 40 && count < 10; ++i) {
+        const uint8_t *obj = &self->oam[i * 4];
+        int y = obj[0] - 16;
+        if (ly >= y && ly < y + height) {
+            int j = count++;
+            while (j > 0 && objs[j - 1][1] > obj[1]) {
+                objs[j] = objs[j - 1];
+                --j;
+            }
+            objs[j] = obj;
+        }
+    }
+
+    // objects stay scalar: a line has at most 80 of their pixels, each with its own palette and
+    // priority, so building an index line and masks for tiles_palette costs more than it saves
+    uint8_t taken[SCREEN_W] = {0}, row[8];
+    for (int i = 0; i < count; ++i) {
+        const uint8_t *obj = objs[i];
+        uint8_t attr = obj[3], pal = (attr & 0x10) ? self->obp1 : self->obp0;
+        uint8_t y = ly - (obj[0] - 16), tile = obj[2];
+        if (attr & 0x40) // y flip
+            y = height - 1 - y;
+        if (height == 16)
+            tile = (tile & 0xfe) | (y >> 3);
+        ppu_tile_row(self, tile, y & 7, row);
+        for (int px = 0; px < 8; ++px) {
+            int x = obj[1] - 8 + px;
+            uint8_t colour = row[(attr & 0x20) ? 7 - px : px]; // x flip
+            if (x < 0 || x >= SCREEN_W || !colour || taken[x])
+                continue;
+            // a higher priority object hides lower ones even when it is itself behind the background
+            taken[x] = 1;
+            if (!(attr & 0x80) || !bg[x])
+                self->fb[ly][x] = (pal >> (colour * 2)) & 3;
+        }
+    }
+}
+
+static void ppu_render_line(ppu *self, uint8_t ly) {
+    // colour indices with room for a tile hanging off either side, the
+    // sprites need these to check background priority
+    uint8_t buf[8 + SCREEN_W + 8] = {0}, *bg = buf + 8;
+
+    if (self->lcdc & 0x01) {
+        // background
+        uint8_t y = ly + self->scy;
+        const uint8_t *map = ppu_vram(self, ((self->lcdc & 0x08) ? 0x1c00 : 0x1800) + (y / 8) * 32);
+        for (int x = -(self->scx & 7), col = self->scx / 8; x < SCREEN_W; x += 8, col = (col + 1) & 31)
+            ppu_tile_row(self, ppu_bg_tile(self, map[col]), y & 7, &bg[x]);
+
+        // window, which keeps its own line counter so it resumes where it left off if hidden
+        if ((self->lcdc & 0x20) && ly >= self->wy && self->wx <= 166) {
+            uint8_t wy = self->win_line++;
+            map = ppu_vram(self, ((self->lcdc & 0x40) ? 0x1c00 : 0x1800) + (wy / 8) * 32);
+            for (int x = self->wx - 7, col = 0; x < SCREEN_W; x += 8, ++col)
+                ppu_tile_row(self, ppu_bg_tile(self, map[col]), wy & 7, &bg[x]);
+        }
+    }
+
+    if (self->lcdc & 0x01)
+        tiles_palette(self->fb[ly], bg, SCREEN_W, self->bgp);
+    else // background off is blank white rather than colour 0
+        memset(self->fb[ly], 0, SCREEN_W);
+
+    if (self->lcdc & 0x02)
+        ppu_render_sprites(self, ly, bg);
+}
+
+void ppu_init(ppu *self, sched *sched) {
+    memset(self, 0, sizeof(*self));
+    self->tile_cache = true; // vram and the cache both start out as zeroes
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i)
+        self->vram[i] = page_new(NULL);
+    self->lcd_start = sched->now;
+    ppu_schedule(self, sched, sched->now);
+}
+
+void ppu_deinit(ppu *self) {
+    for (int i = 0; i < 0x2000 >> PAGE_SHIFT; ++i)
+        page_unref(self->vram[i]);
+}
+
+uint8_t ppu_read(ppu *self, sched *sched, uint16_t addr) {
+    uint32_t pos = ppu_frame_pos(self, sched->now);
+    uint8_t ly = ppu_on(self) ? pos / LINE_CYCLES : 0;
+    switch (addr) {
+        case 0xff40: return self->lcdc; // lcd control
+        case 0xff41: // lcd status
+            return 0x80 | self->stat | ((ly == self->lyc) << 2) | (ppu_on(self) ? ppu_mode(pos) : 0);
+        case 0xff42: return self->scy; // viewport y pos
+        case 0xff43: return self->scx; // viewport x pos
+        case 0xff44: return ly; // lcd y co ordinate
+        case 0xff45: return self->lyc; // lcd y compare
+        case 0xff47: return self->bgp; // bg colour palette
+        case 0xff48: return self->obp0; // obj palette 0 data
+        case 0xff49: return self->obp1; // obj palette 1 data
+        case 0xff4a: return self->wy; // window y pos
+        case 0xff4b: return self->wx; // window x pos + 7
+        default: return 0xff;
+    }
+}
+
+uint8_t ppu_write(ppu *self, sched *sched, uint16_t addr, uint8_t val) {
+    switch (addr) {
+        case 0xff40: // lcd control
+            if (!ppu_on(self) && (val & 0x80))
+                self->lcd_start = sched->now; // starts again from the top of line 0
+            self->lcdc = val;
+            break;
+        case 0xff41: self->stat = val & 0x78; break; // lcd status, only the interrupt selects are writable
+        case 0xff42: self->scy = val; return 0; // viewport y pos
+        case 0xff43: self->scx = val; return 0; // viewport x pos
+        case 0xff45: self->lyc = val; break; // lcd y compare
+        case 0xff47: self->bgp = val; return 0; // bg colour palette
+        case 0xff48: self->obp0 = val; return 0; // obj palette 0 data
+        case 0xff49: self->obp1 = val; return 0; // obj palette 1 data
+        case 0xff4a: self->wy = val; return 0; // window y pos
+        case 0xff4b: self->wx = val; return 0; // window x pos + 7
+        default: return 0; // ly is read only
+    }
+    // only the lcd switch, the interrupt selects and lyc move the next interrupt
+    ppu_schedule(self, sched, sched->now);
+    return 0;
+}
+
+uint8_t ppu_event(ppu *self, sched *sched) {
+    // the event may be handled a few cycles late, use the time it was due
+    uint32_t pos = ppu_frame_pos(self, self->event_time);
+    uint32_t ly = pos / LINE_CYCLES, dot = pos % LINE_CYCLES;
+    if (ly < VISIBLE_LINES && dot == HBLANK_DOT) {
+        ppu_render_line(self, ly);
+    } else if (ly == VISIBLE_LINES && dot == 0) {
+        ++self->frames;
+        self->win_line = 0;
+    }
+    uint8_t irq = ppu_irqs_at(self, pos);
+    ppu_schedule(self, sched, self->event_time);
+    return irq;
+}
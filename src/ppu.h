@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "page.h"
+#include "sched.h"
+
+// m-cycles per line and in each mode of a visible line
+#define LINE_CYCLES 114
+#define MODE2_CYCLES 20
+#define MODE3_CYCLES 43
+#define LINES 154
+#define VISIBLE_LINES 144
+#define SCREEN_W 160
+#define SCREEN_H 144
+
+// ly and the stat mode are worked out from the clock when read, events are
+// only scheduled where a line gets rendered (the end of mode 3, a whole line
+// at a time, no pixel fifo) or an interrupt can be requested
+typedef struct {
+    uint64_t lcd_start; // when the lcd was last switched on
+    uint64_t event_time; // when the pending event is due
+    uint64_t frames; // completed frames, bumped at the start of vblank
+    uint8_t lcdc, stat, scy, scx, lyc, bgp, obp0, obp1, wy, wx;
+    uint8_t win_line; // window lines drawn so far this frame
+    mem_page *vram[0x2000 >> PAGE_SHIFT]; // shared with forks until written, see page.h
+    uint8_t oam[0xa0];
+    uint8_t fb[SCREEN_H][SCREEN_W]; // shades 0 (white) to 3 (black), palettes already applied
+    // every tile in vram expanded to colour indices, redone on use after a write to it
+    bool tile_cache; // on by default, off decodes every row as it is drawn
+    bool tile_dirty[384];
+    uint8_t tiles[384][64];
+} ppu;
+
+void ppu_init(ppu *self, sched *sched);
+void ppu_deinit(ppu *self);
+uint8_t ppu_read(ppu *self, sched *sched, uint16_t addr);
+// these return the interrupts to request
+uint8_t ppu_write(ppu *self, sched *sched, uint16_t addr, uint8_t val);
+uint8_t ppu_event(ppu *self, sched *sched);
+
+// 'off' bytes into vram, a tile or a row of a tile map never crosses a page
+static inline uint8_t *ppu_vram(const ppu *self, uint16_t off) {
+    return &self->vram[off >> PAGE_SHIFT]->data[off & (PAGE_SIZE - 1)];
+}
+
+// writes to vram that aren't mapped go through here, tile data ones keep the tile cache in sync.
+// the page has to be this instance's own
+static inline void ppu_vram_write(ppu *self, uint16_t addr, uint8_t val) {
+    *ppu_vram(self, addr - 0x8000) = val;
+    if (addr < 0x9800)
+        self->tile_dirty[(addr - 0x8000) >> 4] = true;
+}
+
+// fnv-1a over the frame being drawn, for telling runs apart
+static inline uint64_t ppu_frame_hash(const ppu *self) {
+    const uint8_t *fb = &self->fb[0][0];
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(self->fb); ++i)
+        hash = (hash ^ fb[i]) * 0x100000001b3ull;
+    return hash;
+}
@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+bool profile_init(profile *self, const mbc *mbc) {
+    memset(self, 0, sizeof(*self));
+    self->rom_banks = mbc->rom_banks;
+    self->rom_pc = calloc((size_t)self->rom_banks * 0x4000, sizeof(*self->rom_pc));
+    return self->rom_pc;
+}
+
+void profile_deinit(profile *self) {
+    free(self->rom_pc);
+}
+
+// rom addresses as the cpu sees them, bank 0 at 0x0000 and the rest at 0x4000
+static unsigned profile_rom_addr(size_t i) {
+    return (i >= 0x4000 ? 0x4000 : 0) + (i & 0x3fff);
+}
+
+static void profile_csv(const profile *self, FILE *out) {
+    fprintf(out, "kind,bank,address,count,mcycles\n");
+    for (int i = 0; i < 256; ++i)
+        if (self->op_count[i])
+            fprintf(out, "op,,0x%02x,%llu,%llu\n", i, (unsigned long long)self->op_count[i],
+                (unsigned long long)self->op_cycles[i]);
+    for (int i = 0; i < 256; ++i)
+        if (self->cb_count[i])
+            fprintf(out, "cb,,0xcb%02x,%llu,%llu\n", i, (unsigned long long)self->cb_count[i],
+                (unsigned long long)self->cb_cycles[i]);
+    for (size_t i = 0; i < (size_t)self->rom_banks * 0x4000; ++i)
+        if (self->rom_pc[i])
+            fprintf(out, "pc,%zu,0x%04x,%llu,\n", i / 0x4000, profile_rom_addr(i), (unsigned long long)self->rom_pc[i]);
+    for (size_t i = 0; i < 0x8000; ++i)
+        if (self->ram_pc[i])
+            fprintf(out, "pc,,0x%04zx,%llu,\n", 0x8000 + i, (unsigned long long)self->ram_pc[i]);
+}
+
+static void profile_json(const profile *self, FILE *out) {
+    const char *sep = "";
+    fprintf(out, "{\n  \"opcodes\": [");
+    for (int i = 0; i < 256; ++i) {
+        if (self->op_count[i]) {
+            fprintf(out, "%s\n    {\"op\": \"0x%02x\", \"count\": %llu, \"mcycles\": %llu}", sep, i,
+                (unsigned long long)self->op_count[i], (unsigned long long)self->op_cycles[i]);
+            sep = ",";
+        }
+    }
+    sep = "";
+    fprintf(out, "\n  ],\n  \"cb_opcodes\": [");
+    for (int i = 0; i < 256; ++i) {
+        if (self->cb_count[i]) {
+            fprintf(out, "%s\n    {\"op\": \"0xcb%02x\", \"count\": %llu, \"mcycles\": %llu}", sep, i,
+                (unsigned long long)self->cb_count[i], (unsigned long long)self->cb_cycles[i]);
+            sep = ",";
+        }
+    }
+    sep = "";
+    fprintf(out, "\n  ],\n  \"pc\": [");
+    for (size_t i = 0; i < (size_t)self->rom_banks * 0x4000; ++i) {
+        if (self->rom_pc[i]) {
+            fprintf(out, "%s\n    {\"bank\": %zu, \"address\": \"0x%04x\", \"count\": %llu}", sep, i / 0x4000,
+                profile_rom_addr(i), (unsigned long long)self->rom_pc[i]);
+            sep = ",";
+        }
+    }
+    for (size_t i = 0; i < 0x8000; ++i) {
+        if (self->ram_pc[i]) {
+            fprintf(out, "%s\n    {\"bank\": null, \"address\": \"0x%04zx\", \"count\": %llu}", sep, 0x8000 + i,
+                (unsigned long long)self->ram_pc[i]);
+            sep = ",";
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+bool profile_dump(const profile *self, const char *path) {
+    if (!self)
+        return false;
+    FILE *out = fopen(path, "w");
+    if (!out)
+        return false;
+    size_t len = strlen(path);
+    if (len >= 5 && !strcmp(path + len - 5, ".json"))
+        profile_json(self, out);
+    else
+        profile_csv(self, out);
+    return !fclose(out);
+}
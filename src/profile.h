@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbc.h"
+
+// where emulated time goes, only filled in by builds with -Dprofile=true
+typedef struct {
+    uint64_t op_count[256], op_cycles[256];
+    uint64_t cb_count[256], cb_cycles[256];
+    uint64_t *rom_pc; // instructions started at each rom address, bank * 0x4000 + offset
+    uint64_t ram_pc[0x8000]; // and at each address from 0x8000 up
+    uint16_t rom_banks;
+} profile;
+
+// returns false if the histogram can't be allocated
+bool profile_init(profile *self, const mbc *mbc);
+void profile_deinit(profile *self);
+// json if 'path' ends in .json, csv otherwise, only non zero counts are written. false without a profile
+bool profile_dump(const profile *self, const char *path);
+
+// 'cb' is the second byte when 'op' is 0xcb
+static inline void profile_op(profile *self, const mbc *mbc, uint16_t pc, uint8_t op, uint8_t cb, uint8_t cycles) {
+    if (op == 0xcb) {
+        ++self->cb_count[cb];
+        self->cb_cycles[cb] += cycles;
+    } else {
+        ++self->op_count[op];
+        self->op_cycles[op] += cycles;
+    }
+    if (pc >= 0x8000)
+        ++self->ram_pc[pc - 0x8000];
+    else
+        ++self->rom_pc[(pc < 0x4000 ? mbc->rom0 : mbc->romx) * 0x4000 + (pc & 0x3fff)];
+}
@@ -0,0 +1,164 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "state.h"
+
+#define RUN_MAX 0x8000 // zeroes one run can skip
+#define LIT_MAX 0x80 // bytes one literal can hold
+
+// the most 'len' bytes can come to, all literals
+static size_t delta_bound(size_t len) {
+    return len + len / LIT_MAX + 1;
+}
+
+static uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// 'a' xor 'b' as runs: a byte n below 0x80 is followed by n + 1 xored bytes, one with the
+// top bit set and the byte after it skip up to RUN_MAX unchanged ones. returns the length
+static size_t delta_encode(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len) {
+    size_t o = 0, i = 0;
+    while (i < len) {
+        size_t same = i;
+        while (same + 8 <= len && load64(a + same) == load64(b + same))
+            same += 8;
+        while (same < len && a[same] == b[same])
+            ++same;
+        while (i < same) {
+            size_t n = same - i < RUN_MAX ? same - i : RUN_MAX;
+            out[o++] = 0x80 | (n - 1) >> 8;
+            out[o++] = (n - 1) & 0xff;
+            i += n;
+        }
+        // changed bytes, up to where a run would be shorter than the literal it breaks up
+        size_t diff = i;
+        while (diff < len && !(diff + 3 <= len && a[diff] == b[diff] && a[diff + 1] == b[diff + 1] &&
+                                 a[diff + 2] == b[diff + 2]))
+            ++diff;
+        while (i < diff) {
+            size_t n = diff - i < LIT_MAX ? diff - i : LIT_MAX;
+            out[o++] = n - 1;
+            for (size_t j = 0; j < n; ++j, ++i)
+                out[o++] = a[i] ^ b[i];
+        }
+    }
+    return o;
+}
+
+// xors a delta into 'dst', which turns either of the states it was made from into the other
+static void delta_apply(uint8_t *dst, const uint8_t *in, size_t len) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        uint8_t c = in[i++];
+        if (c & 0x80) {
+            o += ((c & 0x7f) << 8 | in[i++]) + 1;
+        } else {
+            for (int n = 0; n <= c; ++n)
+                dst[o++] ^= in[i++];
+        }
+    }
+}
+
+rewind_ring *rewind_new(const sm83 *cpu, size_t bytes, uint32_t interval) {
+    rewind_ring *self = calloc(1, sizeof(*self));
+    if (!self)
+        return NULL;
+    self->state_size = gameboff_state_size(cpu);
+    self->size = bytes > delta_bound(self->state_size) ? bytes : delta_bound(self->state_size);
+    self->cap = self->size / 256 + 1; // far more states than there'd be room for in practice
+    self->interval = interval ? interval : 1;
+    self->buf = malloc(self->size);
+    self->entries = malloc(self->cap * sizeof(*self->entries));
+    self->last = calloc(1, self->state_size); // the first delta is against zeroes
+    self->state = malloc(self->state_size);
+    self->delta = malloc(delta_bound(self->state_size));
+    if (!self->buf || !self->entries || !self->last || !self->state || !self->delta) {
+        rewind_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+void rewind_free(rewind_ring *self) {
+    if (!self)
+        return;
+    free(self->buf);
+    free(self->entries);
+    free(self->last);
+    free(self->state);
+    free(self->delta);
+    free(self);
+}
+
+static rewind_entry *rewind_newest(rewind_ring *self) {
+    return &self->entries[(self->first + self->count - 1) % self->cap];
+}
+
+void rewind_tick(rewind_ring *self, const sm83 *cpu) {
+    if (++self->wait >= self->interval) {
+        self->wait = 0;
+        rewind_push(self, cpu);
+    }
+}
+
+void rewind_push(rewind_ring *self, const sm83 *cpu) {
+    gameboff_save_state(cpu, self->state, self->state_size);
+    size_t len = delta_encode(self->delta, self->state, self->last, self->state_size);
+    uint8_t *swap = self->last;
+    self->last = self->state;
+    self->state = swap;
+
+    // goes after the newest, or back at the start if it doesn't fit before the end
+    size_t end = self->count ? rewind_newest(self)->pos + rewind_newest(self)->len : 0;
+    size_t pos = end + len > self->size ? 0 : end;
+    while (self->count) {
+        const rewind_entry *old = &self->entries[self->first];
+        // anything past the newest is older than everything before it, so it goes first on a wrap
+        bool passed = pos < end && old->pos >= end;
+        bool overlaps = old->pos < pos + len && pos < old->pos + old->len;
+        if (!passed && !overlaps && self->count < self->cap)
+            break;
+        self->first = (self->first + 1) % self->cap;
+        --self->count;
+    }
+    memcpy(self->buf + pos, self->delta, len);
+    self->entries[(self->first + self->count) % self->cap] = (rewind_entry){pos, len, cpu->mmu->sched.now};
+    ++self->count;
+}
+
+// steps 'last' back past the newest entry
+static void rewind_drop(rewind_ring *self) {
+    const rewind_entry *e = rewind_newest(self);
+    delta_apply(self->last, self->buf + e->pos, e->len);
+    --self->count;
+}
+
+bool rewind_pop(rewind_ring *self, sm83 *cpu) {
+    if (!self->count || !gameboff_load_state(cpu, self->last, self->state_size))
+        return false;
+    rewind_drop(self);
+    self->wait = 0;
+    return true;
+}
+
+bool rewind_seek(rewind_ring *self, sm83 *cpu, uint64_t time) {
+    if (!self->count || self->entries[self->first].time > time)
+        return false;
+    while (rewind_newest(self)->time > time)
+        rewind_drop(self);
+    return rewind_pop(self, cpu);
+}
+
+size_t rewind_used(const rewind_ring *self) {
+    size_t used = 0;
+    for (size_t i = 0; i < self->count; ++i)
+        used += self->entries[(self->first + i) % self->cap].len;
+    return used;
+}
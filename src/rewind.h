@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+// a state taken for rewinding, kept as what changed since the one taken before it
+typedef struct {
+    size_t pos, len; // where its delta is in 'buf'
+    uint64_t time; // sched.now when it was taken
+} rewind_entry;
+
+// save states taken every 'interval' frames into a fixed amount of memory, the oldest are
+// dropped to make room. only the newest is kept in full, each entry xors it back into the
+// one before, zero runs and all, so mostly unchanged states take a few bytes
+typedef struct {
+    uint8_t *buf; // the deltas, laid out in the order they were taken and wrapping around
+    size_t size;
+    rewind_entry *entries; // a ring, 'first' is the oldest
+    size_t cap, first, count;
+    uint8_t *last; // the newest state in full, or what the oldest delta applies to once it's gone
+    uint8_t *state, *delta; // scratch for taking one
+    size_t state_size;
+    uint32_t interval, wait;
+} rewind_ring;
+
+// 'bytes' of history for 'cpu', at least enough for one state whatever the deltas come to.
+// returns NULL if it can't be allocated
+rewind_ring *rewind_new(const sm83 *cpu, size_t bytes, uint32_t interval);
+void rewind_free(rewind_ring *self);
+// call once a frame, takes a state every 'interval' calls
+void rewind_tick(rewind_ring *self, const sm83 *cpu);
+void rewind_push(rewind_ring *self, const sm83 *cpu);
+// loads the newest state into 'cpu' and drops it, so each call goes further back.
+// returns false once there's nothing left
+bool rewind_pop(rewind_ring *self, sm83 *cpu);
+// loads the newest state taken at or before 'time', dropping everything after it, for
+// finding the first frame something went wrong in. false if they've all been dropped
+bool rewind_seek(rewind_ring *self, sm83 *cpu, uint64_t time);
+// history held, in bytes of deltas
+size_t rewind_used(const rewind_ring *self);
@@ -0,0 +1,89 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+
+// the smallest cart is two 16KiB banks, header byte 0x148 doubles that
+static size_t rom_declared_size(const uint8_t *data, size_t len) {
+    if (len <= 0x148 || data[0x148] > 8)
+        return 0x8000;
+    return (size_t)0x8000 << data[0x148];
+}
+
+bool rom_open(rom_image *self, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+
+    size_t len = st.st_size;
+    void *map = len ? mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    size_t need = map != MAP_FAILED ? rom_declared_size(map, len) : 0x8000;
+    if (map != MAP_FAILED && len >= need) {
+        close(fd);
+        self->data = map;
+        self->size = len;
+        self->mapped = true;
+        return true;
+    }
+
+    // touching a mapping past the end of the file faults, so short
+    // (usually homebrew or test) roms are read into a zeroed buffer instead
+    if (map != MAP_FAILED)
+        munmap(map, len);
+    uint8_t *buf = calloc(1, need > len ? need : len);
+    size_t got = 0;
+    while (buf && got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, got);
+        if (n <= 0) {
+            free(buf);
+            buf = NULL;
+        } else {
+            got += n;
+        }
+    }
+    close(fd);
+    if (!buf)
+        return false;
+    self->data = buf;
+    self->size = need > len ? need : len;
+    self->mapped = false;
+    return true;
+}
+
+void rom_close(rom_image *self) {
+    if (self->mapped)
+        munmap((void *)self->data, self->size);
+    else
+        free((void *)self->data);
+    self->data = NULL;
+    self->size = 0;
+}
+
+uint8_t *sav_open(const char *path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return NULL;
+    // some emulators append the rtc after the ram, keep that but make sure the ram fits
+    struct stat st;
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size < size && ftruncate(fd, size) == -1)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map != MAP_FAILED ? map : NULL;
+}
+
+void sav_close(uint8_t *sav, size_t size) {
+    munmap(sav, size);
+}
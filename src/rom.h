@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// a cartridge image, mapped read only so every instance (and process) running
+// the same file shares one page cache copy and nothing is copied at startup
+typedef struct {
+    const uint8_t *data;
+    size_t size; // at least as much as the header says the cartridge has
+    bool mapped; // false if the file was shorter than its header and got copied into a padded buffer
+} rom_image;
+
+// returns false if the file can't be read
+bool rom_open(rom_image *self, const char *path);
+void rom_close(rom_image *self);
+
+// battery backed cart ram lives in a .sav file mapped MAP_SHARED, so every write is
+// already in the page cache and nothing is lost if the process is killed, the file
+// is created or resized to 'size' bytes, returns NULL on failure
+uint8_t *sav_open(const char *path, size_t size);
+void sav_close(uint8_t *sav, size_t size);
@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sched.h"
+
+void sched_init(sched *self) {
+    memset(self, 0, sizeof(*self));
+    self->next = UINT64_MAX;
+}
+
+static void sched_remove(sched *self, sched_event ev) {
+    for (uint8_t i = 0; i < self->len; ++i) {
+        if (self->queue[i].ev == ev) {
+            memmove(&self->queue[i], &self->queue[i + 1], (self->len - i - 1) * sizeof(sched_entry));
+            --self->len;
+            break;
+        }
+    }
+}
+
+static void sched_update_next(sched *self) {
+    self->next = self->len ? self->queue[0].when : UINT64_MAX;
+}
+
+void sched_set(sched *self, sched_event ev, uint64_t when) {
+    sched_remove(self, ev);
+    uint8_t i = self->len;
+    // insertion sort, events at the same time keep the order they were added in
+    while (i > 0 && self->queue[i - 1].when > when) {
+        self->queue[i] = self->queue[i - 1];
+        --i;
+    }
+    self->queue[i].when = when;
+    self->queue[i].ev = ev;
+    ++self->len;
+    sched_update_next(self);
+}
+
+void sched_cancel(sched *self, sched_event ev) {
+    sched_remove(self, ev);
+    sched_update_next(self);
+}
+
+int sched_pop(sched *self) {
+    if (!self->len || self->queue[0].when > self->now) {
+        sched_update_next(self);
+        return -1;
+    }
+    int ev = self->queue[0].ev;
+    memmove(&self->queue[0], &self->queue[1], (self->len - 1) * sizeof(sched_entry));
+    --self->len;
+    sched_update_next(self);
+    return ev;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// everything that has to happen at a specific m-cycle, each source has at most one pending event
+typedef enum {
+    EV_TIMER, // tima overflow
+    EV_PPU, // vblank and stat interrupts
+    EV_SERIAL, // serial transfer done
+    EV_COUNT
+} sched_event;
+
+typedef struct {
+    uint64_t when;
+    uint8_t ev;
+} sched_entry;
+
+typedef struct {
+    uint64_t now; // m-cycles since power on
+    uint64_t next; // when the earliest pending event is due, UINT64_MAX if there is none
+    sched_entry queue[EV_COUNT]; // sorted by when, a handful of entries so no heap needed
+    uint8_t len;
+} sched;
+
+void sched_init(sched *self);
+// (re)schedules 'ev' at the absolute time 'when', replacing its pending entry if it has one
+void sched_set(sched *self, sched_event ev, uint64_t when);
+void sched_cancel(sched *self, sched_event ev);
+// removes and returns the earliest event if it is due, -1 otherwise (which also clears a kick)
+int sched_pop(sched *self);
+
+static inline bool sched_due(const sched *self) {
+    return self->now >= self->next;
+}
+
+// makes the cpu drop out of its inner loop, e.g. when an interrupt may have become pending
+static inline void sched_kick(sched *self) {
+    self->next = self->now;
+}
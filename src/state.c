@@ -0,0 +1,267 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.h"
+
+#define STATE_MAGIC "GBFS"
+#define STATE_HEADER_SIZE 16
+
+// the same walk over the fields saves, loads and counts (with no buffer)
+typedef struct {
+    uint8_t *buf;
+    size_t pos;
+    bool load;
+    size_t mbc_pos, sched_pos, apu_pos; // where the sections loading has to check start
+} state_io;
+
+static void io_bytes(state_io *io, void *data, size_t len) {
+    if (io->buf && len) {
+        if (io->load)
+            memcpy(data, io->buf + io->pos, len);
+        else
+            memcpy(io->buf + io->pos, data, len);
+    }
+    io->pos += len;
+}
+
+// pages of ram, one that is shared with a fork is only copied if loading changes it
+static void io_pages(state_io *io, mem_page **pages, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (io->buf && io->load && !memcmp(pages[i]->data, io->buf + io->pos, PAGE_SIZE))
+            io->pos += PAGE_SIZE;
+        else
+            io_bytes(io, io->load && io->buf ? page_own(&pages[i])->data : pages[i]->data, PAGE_SIZE);
+    }
+}
+
+static void io_u8(state_io *io, uint8_t *v) {
+    io_bytes(io, v, 1);
+}
+
+static void io_bool(state_io *io, bool *v) {
+    uint8_t b = *v;
+    io_bytes(io, &b, 1);
+    *v = b;
+}
+
+static void io_u16(state_io *io, uint16_t *v) {
+    uint8_t b[2] = {*v & 0xff, *v >> 8};
+    io_bytes(io, b, 2);
+    *v = b[0] | (b[1] << 8);
+}
+
+static void io_u32(state_io *io, uint32_t *v) {
+    uint8_t b[4] = {*v & 0xff, (*v >> 8) & 0xff, (*v >> 16) & 0xff, *v >> 24};
+    io_bytes(io, b, 4);
+    *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void io_u64(state_io *io, uint64_t *v) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; ++i)
+        b[i] = *v >> (i * 8);
+    io_bytes(io, b, 8);
+    *v = 0;
+    for (int i = 0; i < 8; ++i)
+        *v |= (uint64_t)b[i] << (i * 8);
+}
+
+static void state_cpu(state_io *io, sm83 *cpu) {
+    io_u16(io, &cpu->pc);
+    io_u16(io, &cpu->sp);
+    io_u16(io, &cpu->af.pair);
+    io_u16(io, &cpu->bc.pair);
+    io_u16(io, &cpu->de.pair);
+    io_u16(io, &cpu->hl.pair);
+    io_bool(io, &cpu->halt);
+    io_bool(io, &cpu->ime);
+    io_bool(io, &cpu->ei);
+    io_u64(io, &cpu->insts);
+}
+
+static void state_sched(state_io *io, sched *sched) {
+    io_u64(io, &sched->now);
+    io_u64(io, &sched->next);
+    io_u8(io, &sched->len);
+    for (int i = 0; i < EV_COUNT; ++i) {
+        io_u64(io, &sched->queue[i].when);
+        io_u8(io, &sched->queue[i].ev);
+    }
+}
+
+static void state_timer(state_io *io, timer *timer) {
+    io_u64(io, &timer->div_reset);
+    io_u64(io, &timer->tima_time);
+    io_u8(io, &timer->tima);
+    io_u8(io, &timer->tma);
+    io_u8(io, &timer->tac);
+}
+
+static void state_ppu(state_io *io, ppu *ppu) {
+    io_u64(io, &ppu->lcd_start);
+    io_u64(io, &ppu->event_time);
+    io_u64(io, &ppu->frames);
+    io_u8(io, &ppu->lcdc);
+    io_u8(io, &ppu->stat);
+    io_u8(io, &ppu->scy);
+    io_u8(io, &ppu->scx);
+    io_u8(io, &ppu->lyc);
+    io_u8(io, &ppu->bgp);
+    io_u8(io, &ppu->obp0);
+    io_u8(io, &ppu->obp1);
+    io_u8(io, &ppu->wy);
+    io_u8(io, &ppu->wx);
+    io_u8(io, &ppu->win_line);
+    io_pages(io, ppu->vram, 0x2000 >> PAGE_SHIFT);
+    io_bytes(io, ppu->oam, sizeof(ppu->oam));
+    // the frame being drawn, so frame hashes don't depend on where the state was taken
+    io_bytes(io, ppu->fb, sizeof(ppu->fb));
+}
+
+// the output buffer isn't saved, it carries on from wherever it is
+static void state_apu(state_io *io, apu *apu) {
+    io_u64(io, &apu->time);
+    io_u64(io, &apu->fs_time);
+    io_u8(io, &apu->fs_step);
+    io_bytes(io, apu->regs, sizeof(apu->regs));
+    io_bytes(io, apu->wave, sizeof(apu->wave));
+    for (int i = 0; i < 4; ++i) {
+        apu_channel *ch = &apu->ch[i];
+        io_bool(io, &ch->on);
+        io_u16(io, &ch->len);
+        io_u8(io, &ch->vol);
+        io_u8(io, &ch->env_timer);
+        io_u32(io, &ch->timer);
+        io_u8(io, &ch->pos);
+    }
+    io_u16(io, &apu->shadow);
+    io_u8(io, &apu->sweep_timer);
+    io_bool(io, &apu->sweep_on);
+    io_u16(io, &apu->lfsr);
+}
+
+static void state_mbc(state_io *io, mbc *mbc) {
+    io_bool(io, &mbc->ram_enable);
+    io_bool(io, &mbc->mode);
+    io_u16(io, &mbc->bank_lo);
+    io_u8(io, &mbc->bank_hi);
+    io_u16(io, &mbc->rom0);
+    io_u16(io, &mbc->romx);
+    io_u8(io, &mbc->ram_bank);
+    io_u64(io, &mbc->rtc_time);
+    io_u64(io, &mbc->rtc_secs);
+    io_bool(io, &mbc->rtc_halt);
+    io_bool(io, &mbc->rtc_carry);
+    io_bool(io, &mbc->rtc_latch_armed);
+    io_bytes(io, mbc->rtc_latched, sizeof(mbc->rtc_latched));
+}
+
+static void state_mmu(state_io *io, _mmu *mmu) {
+    io->mbc_pos = io->pos;
+    state_mbc(io, &mmu->mbc);
+    io_pages(io, mmu->cram, mmu->cram_size >> PAGE_SHIFT);
+    io_pages(io, mmu->wram, 0x2000 >> PAGE_SHIFT);
+    io_bytes(io, mmu->io, sizeof(mmu->io));
+    io_bytes(io, mmu->hram, sizeof(mmu->hram));
+    io->sched_pos = io->pos;
+    state_sched(io, &mmu->sched);
+    state_timer(io, &mmu->timer);
+    state_ppu(io, &mmu->ppu);
+    io->apu_pos = io->pos;
+    state_apu(io, &mmu->apu);
+    io_u8(io, &mmu->joypad.select);
+    io_u8(io, &mmu->joypad.buttons);
+    io_u8(io, &mmu->serial_in);
+}
+
+static void state_body(state_io *io, sm83 *cpu) {
+    state_cpu(io, cpu);
+    state_mmu(io, cpu->mmu);
+}
+
+// magic, version, total size and the rom header/global checksums to tell roms apart
+static void state_header(const sm83 *cpu, uint8_t *out, size_t size) {
+    memcpy(out, STATE_MAGIC, 4);
+    out[4] = STATE_VERSION & 0xff;
+    out[5] = STATE_VERSION >> 8;
+    for (int i = 0; i < 4; ++i)
+        out[6 + i] = size >> (i * 8);
+    memcpy(out + 10, &cpu->mmu->rom[0x14d], 3);
+    memset(out + 13, 0, STATE_HEADER_SIZE - 13);
+}
+
+static state_io state_count(const sm83 *cpu) {
+    state_io io = {.pos = STATE_HEADER_SIZE};
+    state_body(&io, (sm83 *)cpu); // counting only, nothing is touched
+    return io;
+}
+
+size_t gameboff_state_size(const sm83 *cpu) {
+    return state_count(cpu).pos;
+}
+
+// the fields loading indexes memory with, read into copies from where 'layout' found them so
+// nothing has been loaded yet if they're out of range
+static bool state_check(const sm83 *cpu, const uint8_t *buf, const state_io *layout) {
+    mbc mapper = cpu->mmu->mbc;
+    state_io io = {.buf = (uint8_t *)buf, .pos = layout->mbc_pos, .load = true};
+    state_mbc(&io, &mapper);
+    if (mapper.rom0 >= mapper.rom_banks || mapper.romx >= mapper.rom_banks)
+        return false;
+
+    sched events;
+    io.pos = layout->sched_pos;
+    state_sched(&io, &events);
+    if (events.len > EV_COUNT)
+        return false;
+    uint8_t seen = 0; // each event is queued once at most
+    for (int i = 0; i < events.len; ++i) {
+        uint8_t ev = events.queue[i].ev;
+        if (ev >= EV_COUNT || seen & (1 << ev))
+            return false;
+        seen |= 1 << ev;
+    }
+
+    apu sound = cpu->mmu->apu;
+    io.pos = layout->apu_pos;
+    state_apu(&io, &sound);
+    // synthesis runs from 'time' up to the next frame sequencer step, never backwards or past one
+    if (sound.fs_time < sound.time || sound.fs_time - sound.time > APU_FS_CYCLES)
+        return false;
+    for (int i = 0; i < 4; ++i) {
+        if (sound.ch[i].pos >= (i == 2 ? 32 : 8)) // the wave channel steps through 32 samples, the rest 8
+            return false;
+    }
+    return true;
+}
+
+size_t gameboff_save_state(const sm83 *cpu, void *buf, size_t len) {
+    size_t size = gameboff_state_size(cpu);
+    if (len < size)
+        return 0;
+    state_header(cpu, buf, size);
+    state_io io = {.buf = buf, .pos = STATE_HEADER_SIZE};
+    state_body(&io, (sm83 *)cpu); // saving only reads the fields
+    return io.pos;
+}
+
+bool gameboff_load_state(sm83 *cpu, const void *buf, size_t len) {
+    state_io layout = state_count(cpu);
+    size_t size = layout.pos;
+    uint8_t header[STATE_HEADER_SIZE];
+    state_header(cpu, header, size);
+    if (len < size || memcmp(buf, header, STATE_HEADER_SIZE) || !state_check(cpu, buf, &layout))
+        return false;
+
+    _mmu *mmu = cpu->mmu;
+    state_io io = {.buf = (uint8_t *)buf, .pos = STATE_HEADER_SIZE, .load = true}; // loading only reads the buffer
+    state_body(&io, cpu);
+    cpu->mmu = mmu;
+
+    // derived state that isn't saved
+    mmu_remap(mmu);
+    memset(mmu->ppu.tile_dirty, true, sizeof(mmu->ppu.tile_dirty));
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+
+// bump whenever the layout changes, states from any other version are refused
+#define STATE_VERSION 7
+
+// save states hold everything except the rom and bootrom images, in a fixed
+// little endian layout, and never allocate so they can go in any buffer
+
+// bytes needed to save 'cpu', the same for every state of a given rom
+size_t gameboff_state_size(const sm83 *cpu);
+// returns the number of bytes written or 0 if 'len' is too small
+size_t gameboff_save_state(const sm83 *cpu, void *buf, size_t len);
+// 'cpu' must already be set up by sm83_init with the same rom, returns false and leaves
+// it untouched if the state is for another rom, version or size, or has banks, scheduled
+// events or audio timing out of range
+bool gameboff_load_state(sm83 *cpu, const void *buf, size_t len);
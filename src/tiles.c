@@ -0,0 +1,82 @@
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "tiles.h"
+
+void tiles_decode(uint8_t *out, const uint8_t *tile) {
+#if defined(__SSE2__)
+    // 16 pixels (two rows) at a time, each byte of 'bits' picks out one pixel
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2);
+    __m128i t = _mm_loadu_si128((const __m128i *)tile);
+    // spread each plane byte across 8 lanes: b holds lo0 x4, hi0 x4, lo1 x4, hi1 x4 etc.
+    __m128i pairs[2] = {_mm_unpacklo_epi8(t, t), _mm_unpackhi_epi8(t, t)};
+    for (int i = 0; i < 4; ++i) {
+        __m128i b = (i & 1) ? _mm_unpackhi_epi16(pairs[i >> 1], pairs[i >> 1])
+                            : _mm_unpacklo_epi16(pairs[i >> 1], pairs[i >> 1]);
+        __m128i r0 = _mm_unpacklo_epi32(b, b), r1 = _mm_unpackhi_epi32(b, b); // lo x8, hi x8
+        __m128i lo = _mm_unpacklo_epi64(r0, r1), hi = _mm_unpackhi_epi64(r0, r1);
+        lo = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), one);
+        hi = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), two);
+        _mm_storeu_si128((__m128i *)(out + i * 16), _mm_or_si128(lo, hi));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t bits = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+    for (int i = 0; i < 4; ++i) {
+        const uint8_t *rows = tile + i * 4;
+        uint8x16_t lo = vcombine_u8(vdup_n_u8(rows[0]), vdup_n_u8(rows[2]));
+        uint8x16_t hi = vcombine_u8(vdup_n_u8(rows[1]), vdup_n_u8(rows[3]));
+        lo = vandq_u8(vtstq_u8(lo, bits), vdupq_n_u8(1));
+        hi = vandq_u8(vtstq_u8(hi, bits), vdupq_n_u8(2));
+        vst1q_u8(out + i * 16, vorrq_u8(lo, hi));
+    }
+#else
+    for (int row = 0; row < 8; ++row) {
+        uint8_t lo = tile[row * 2], hi = tile[row * 2 + 1];
+        for (int i = 0; i < 8; ++i)
+            out[row * 8 + i] = ((lo >> (7 - i)) & 1) | (((hi >> (7 - i)) & 1) << 1);
+    }
+#endif
+}
+
+void tiles_palette(uint8_t *out, const uint8_t *idx, int len, uint8_t pal) {
+    int i = 0;
+#if defined(__AVX2__)
+    // pshufb works within 128 bit lanes so the 4 entry table is repeated in both
+    const __m256i lut = _mm256_setr_epi8(pal & 3, (pal >> 2) & 3, (pal >> 4) & 3, pal >> 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        pal & 3, (pal >> 2) & 3, (pal >> 4) & 3, pal >> 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; i + 32 <= len; i += 32)
+        _mm256_storeu_si256((__m256i *)(out + i),
+            _mm256_shuffle_epi8(lut, _mm256_loadu_si256((const __m256i *)(idx + i))));
+#elif defined(__SSE2__)
+    // no byte shuffle in sse2, select each shade with a compare instead
+    __m128i shade[4], colour[4];
+    for (int c = 0; c < 4; ++c) {
+        shade[c] = _mm_set1_epi8((pal >> (c * 2)) & 3);
+        colour[c] = _mm_set1_epi8(c);
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(idx + i)), res = _mm_setzero_si128();
+        for (int c = 0; c < 4; ++c)
+            res = _mm_or_si128(res, _mm_and_si128(_mm_cmpeq_epi8(v, colour[c]), shade[c]));
+        _mm_storeu_si128((__m128i *)(out + i), res);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t lut = {pal & 3, (pal >> 2) & 3, (pal >> 4) & 3, pal >> 6};
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(out + i, vqtbl1q_u8(lut, vld1q_u8(idx + i)));
+#endif
+    // whatever is left over, or everything without simd
+    const uint8_t lut1[4] = {pal & 3, (pal >> 2) & 3, (pal >> 4) & 3, pal >> 6};
+    for (; i < len; ++i)
+        out[i] = lut1[idx[i] & 3];
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+// pixel kernels for the ppu, sse2/avx2/neon when the compiler targets them
+// and plain c otherwise
+
+// expands a whole 16 byte 2bpp tile into 64 colour indices, row by row
+void tiles_decode(uint8_t *out, const uint8_t *tile);
+// maps 'len' colour indices through a dmg palette register into shades
+void tiles_palette(uint8_t *out, const uint8_t *idx, int len, uint8_t pal);
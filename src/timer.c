@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmu.h"
+#include "timer.h"
+
+// m-cycles between tima increments for each tac clock select
+static const uint16_t timer_period[4] = {256, 4, 16, 64};
+
+static inline bool timer_enabled(timer *self) {
+    return self->tac & 0x4;
+}
+
+// number of falling edges of the selected divider bit since div was cleared
+static inline uint64_t timer_ticks(timer *self, uint64_t t) {
+    return (t - self->div_reset) / timer_period[self->tac & 3];
+}
+
+// bring tima up to date, returns true if it overflowed along the way
+static bool timer_sync(timer *self, uint64_t now) {
+    bool overflow = false;
+    if (timer_enabled(self)) {
+        uint64_t v = self->tima + timer_ticks(self, now) - timer_ticks(self, self->tima_time);
+        // reloads from tma, so after the first overflow it counts round 0x100 - tma values. a read
+        // inside a long instruction can be a few ticks past the event, which wraps again with tma = 0xff
+        if (v > 0xff) {
+            v = self->tma + (v - 0x100) % (0x100 - self->tma);
+            overflow = true;
+        }
+        self->tima = v;
+    }
+    self->tima_time = now;
+    return overflow;
+}
+
+static void timer_schedule(timer *self, sched *sched) {
+    if (timer_enabled(self)) {
+        uint64_t k = timer_ticks(self, sched->now) + (0x100 - self->tima);
+        sched_set(sched, EV_TIMER, self->div_reset + k * timer_period[self->tac & 3]);
+    } else {
+        sched_cancel(sched, EV_TIMER);
+    }
+}
+
+void timer_init(timer *self, sched *sched) {
+    self->div_reset = sched->now;
+    self->tima_time = sched->now;
+    self->tima = 0;
+    self->tma = 0;
+    self->tac = 0;
+    timer_schedule(self, sched);
+}
+
+uint8_t timer_read(timer *self, sched *sched, uint16_t addr) {
+    switch (addr) {
+        case 0xff04: // divider register, incremented at 16384Hz/every 64 m-cycles
+            return (sched->now - self->div_reset) >> 6;
+        case 0xff05: // timer counter
+            timer_sync(self, sched->now);
+            return self->tima;
+        case 0xff06: // timer modulo
+            return self->tma;
+        case 0xff07: // timer control
+            return self->tac | 0xf8;
+        default:
+            return 0xff;
+    }
+}
+
+uint8_t timer_write(timer *self, sched *sched, uint16_t addr, uint8_t val) {
+    uint8_t irq = 0;
+    if (timer_sync(self, sched->now))
+        irq = INT_TIMER;
+    switch (addr) {
+        case 0xff04: { // divider register, writing clears
+            // clearing the divider is a falling edge if the selected bit was set
+            uint16_t period = timer_period[self->tac & 3];
+            if (timer_enabled(self) && (sched->now - self->div_reset) % period >= period / 2) {
+                if (++self->tima == 0) {
+                    self->tima = self->tma;
+                    irq = INT_TIMER;
+                }
+            }
+            self->div_reset = sched->now;
+            break;
+        }
+        case 0xff05: // timer counter
+            self->tima = val;
+            break;
+        case 0xff06: // timer modulo
+            self->tma = val;
+            break;
+        case 0xff07: // timer control
+            self->tac = val & 7;
+            break;
+    }
+    timer_schedule(self, sched);
+    return irq;
+}
+
+uint8_t timer_event(timer *self, sched *sched) {
+    uint8_t irq = timer_sync(self, sched->now) ? INT_TIMER : 0;
+    timer_schedule(self, sched);
+    return irq;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "sched.h"
+
+// div and tima are not ticked, they are worked out from the clock when read
+// and the only event is tima overflowing
+typedef struct {
+    uint64_t div_reset; // when the 16 bit divider was last cleared
+    uint64_t tima_time; // when tima was last brought up to date
+    uint8_t tima, tma, tac;
+} timer;
+
+void timer_init(timer *self, sched *sched);
+uint8_t timer_read(timer *self, sched *sched, uint16_t addr);
+// these return the interrupts to request
+uint8_t timer_write(timer *self, sched *sched, uint16_t addr, uint8_t val);
+uint8_t timer_event(timer *self, sched *sched);
@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// writes whatever is in the ring, returns the number of records written
+static uint64_t trace_drain(trace *self) {
+    uint64_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+    uint64_t n = head - tail;
+    while (tail != head) {
+        // up to the end of the ring in one go
+        uint64_t start = tail & (TRACE_RING - 1), len = head - tail;
+        if (start + len > TRACE_RING)
+            len = TRACE_RING - start;
+        fwrite(&self->ring[start], sizeof(trace_record), len, self->out);
+        tail += len;
+    }
+    atomic_store_explicit(&self->tail, tail, memory_order_release);
+    return n;
+}
+
+static void *trace_thread(void *arg) {
+    trace *self = arg;
+    const struct timespec nap = {0, 1000000};
+    while (!atomic_load_explicit(&self->stop, memory_order_acquire)) {
+        if (!trace_drain(self))
+            nanosleep(&nap, NULL);
+    }
+    trace_drain(self);
+    return NULL;
+}
+
+bool trace_open(trace *self, const char *path, bool threaded) {
+    self->out = fopen(path, "wb");
+    if (!self->out)
+        return false;
+    uint8_t header[TRACE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    header[5] = sizeof(trace_record);
+    fwrite(header, 1, sizeof(header), self->out);
+
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->stop, false);
+    self->tail_cache = 0;
+    self->threaded = threaded;
+    if (threaded && pthread_create(&self->thread, NULL, trace_thread, self))
+        self->threaded = false; // drain it ourselves then
+    return true;
+}
+
+void trace_wait(trace *self) {
+    if (!self->threaded) {
+        trace_drain(self);
+    } else {
+        // the drain thread is behind, waiting keeps the trace complete
+        const struct timespec nap = {0, 100000};
+        while (atomic_load_explicit(&self->head, memory_order_relaxed)
+                - atomic_load_explicit(&self->tail, memory_order_acquire) == TRACE_RING)
+            nanosleep(&nap, NULL);
+    }
+    self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+}
+
+void trace_flush(trace *self) {
+    if (self->threaded) {
+        const struct timespec nap = {0, 100000};
+        while (atomic_load_explicit(&self->tail, memory_order_acquire)
+                != atomic_load_explicit(&self->head, memory_order_relaxed))
+            nanosleep(&nap, NULL);
+    } else {
+        trace_drain(self);
+    }
+    self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+    fflush(self->out);
+}
+
+void trace_close(trace *self) {
+    if (self->threaded) {
+        atomic_store_explicit(&self->stop, true, memory_order_release);
+        pthread_join(self->thread, NULL);
+    } else {
+        trace_drain(self);
+    }
+    fclose(self->out);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// a trace file is this header followed by one record per instruction
+#define TRACE_MAGIC "GBTR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 8
+// records in the ring, a power of 2
+#define TRACE_RING 65536
+
+// the state before an instruction runs, all bytes so the file doesn't depend on the host
+typedef struct {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t sp[2], pc[2]; // little endian
+    uint8_t pcmem[4]; // the instruction and whatever follows it
+} trace_record;
+
+// single producer (the emulation thread) single consumer ring, drained either
+// by a background thread or by the producer itself when it fills up
+typedef struct {
+    trace_record ring[TRACE_RING];
+    _Atomic uint64_t head; // written by the producer
+    _Atomic uint64_t tail; // written by whoever drains
+    uint64_t tail_cache; // the producer's last look at tail
+    FILE *out;
+    bool threaded;
+    atomic_bool stop;
+    pthread_t thread;
+} trace;
+
+// starts writing records to 'path', a background thread drains the ring if
+// 'threaded', otherwise it's drained when full and on trace_flush
+bool trace_open(trace *self, const char *path, bool threaded);
+// writes out everything recorded so far, only from the producer thread when not threaded
+void trace_flush(trace *self);
+void trace_close(trace *self);
+void trace_wait(trace *self); // blocks the producer until there is room
+
+static inline void trace_push(trace *self, const trace_record *rec) {
+    uint64_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    if (head - self->tail_cache == TRACE_RING)
+        trace_wait(self);
+    self->ring[head & (TRACE_RING - 1)] = *rec;
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+// turns a binary trace from gameboff -t into gameboy doctor's text log
+int main(int argc, char **argv) {
+    const char *help = "gameboff-tracefmt trace [output]\n"
+                       "Writes the trace as a Gameboy Doctor log to 'output', or stdout\n";
+    if (argc < 2 || argc > 3 || !strcmp(argv[1], "-h")) {
+        fprintf(stderr, "%s", help);
+        return argc == 2 ? 0 : 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Unable to read trace \"%s\"\n", argv[1]);
+        return 1;
+    }
+    uint8_t header[TRACE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4)
+            || header[4] != TRACE_VERSION || header[5] != sizeof(trace_record)) {
+        fprintf(stderr, "\"%s\" is not a trace this version can read\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Unable to write \"%s\"\n", argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    trace_record recs[4096];
+    size_t n;
+    while ((n = fread(recs, sizeof(trace_record), 4096, in))) {
+        for (size_t i = 0; i < n; ++i) {
+            const trace_record *r = &recs[i];
+            fprintf(out, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+                r->a, r->f, r->b, r->c, r->d, r->e, r->h, r->l, r->sp[0] | (r->sp[1] << 8), r->pc[0] | (r->pc[1] << 8),
+                r->pcmem[0], r->pcmem[1], r->pcmem[2], r->pcmem[3]);
+        }
+    }
+
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}